@@ -0,0 +1,858 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define TP_COUNT_FUTEX // 数线程池自己进了几次futex
+#include "threadpool.h"
+#include "ioexecutor.h"
+#include "poolgroup.h"
+
+// 线程池微基准  make bench && ./bench            人看的表格
+//              ./bench --json > bench.json     机器读的JSON，换个编译选项再跑一次对比
+//              ./bench --reps 5 --quick        每项跑几次取中位数 / 少跑点
+// 全部是空任务或者几微秒的任务，测的是提交和取任务的路径本身
+
+// 统计全进程的堆分配次数，看每次提交要new几回
+// 不让内联，不然编译器看到new出来的指针被free，报-Wmismatched-new-delete
+static std::atomic<long> allocCount(0);
+
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static const char *scheduleName(tpSchedule schedule)
+{
+    return schedule == tpSchedule::STEALING_ ? "stealing" : "shared";
+}
+
+static const char *queueName(tpQueue queue)
+{
+    return queue == tpQueue::LOCKFREE_ ? "lockfree" : "locked";
+}
+
+static const char *patternName(tpPattern pattern)
+{
+    return pattern == tpPattern::CACHED_ ? "cached" : "fixed";
+}
+
+static const char *placementName(tpPlacement placement)
+{
+    switch (placement)
+    {
+    case tpPlacement::PINNED_:
+        return "pinned";
+    case tpPlacement::SPREAD_:
+        return "spread";
+    case tpPlacement::COMPACT_:
+        return "compact";
+    default:
+        return "none";
+    }
+}
+
+//---------------------------------------------
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+using Metrics = std::vector<std::pair<std::string, double>>;
+
+// 所有结果都从这里出：默认每个section一张表，--json时最后一起吐JSON
+class Report
+{
+public:
+    explicit Report(bool json)
+        : json_(json)
+    {
+    }
+
+    void section(const std::string &name)
+    {
+        sections_.push_back(Section{name, {}});
+    }
+
+    void add(Labels labels, Metrics metrics)
+    {
+        Section &s = sections_.back();
+        s.rows.push_back(Row{std::move(labels), std::move(metrics)});
+        if (!json_)
+        {
+            printRow(s, s.rows.size() == 1);
+        }
+    }
+
+    void finish(int reps)
+    {
+        if (!json_)
+        {
+            return;
+        }
+        std::printf("{\n  \"meta\": {\"compiler\": \"%s\", \"hardware_concurrency\": %u, \"tp_stats\": %d, \"reps\": %d, \"time\": %ld},\n",
+                    __VERSION__, std::thread::hardware_concurrency(), TP_STATS, reps, (long)std::time(nullptr));
+        std::printf("  \"results\": [\n");
+        bool first = true;
+        for (const Section &s : sections_)
+        {
+            for (const Row &r : s.rows)
+            {
+                std::printf("%s    {\"bench\": \"%s\"", first ? "" : ",\n", s.name.c_str());
+                for (const auto &l : r.labels)
+                {
+                    std::printf(", \"%s\": \"%s\"", l.first.c_str(), l.second.c_str());
+                }
+                for (const auto &m : r.metrics)
+                {
+                    std::printf(", \"%s\": %.4g", m.first.c_str(), m.second);
+                }
+                std::printf("}");
+                first = false;
+            }
+        }
+        std::printf("\n  ]\n}\n");
+    }
+
+private:
+    struct Row
+    {
+        Labels labels;
+        Metrics metrics;
+    };
+    struct Section
+    {
+        std::string name;
+        std::vector<Row> rows;
+    };
+
+    void printRow(const Section &s, bool header)
+    {
+        const Row &r = s.rows.back();
+        if (header)
+        {
+            std::printf("\n[%s]\n", s.name.c_str());
+            for (const auto &l : r.labels)
+            {
+                std::printf("%-10s ", l.first.c_str());
+            }
+            for (const auto &m : r.metrics)
+            {
+                std::printf("%14s ", m.first.c_str());
+            }
+            std::printf("\n");
+        }
+        for (const auto &l : r.labels)
+        {
+            std::printf("%-10s ", l.second.c_str());
+        }
+        for (const auto &m : r.metrics)
+        {
+            std::printf("%14.2f ", m.second);
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+    }
+
+    bool json_;
+    std::vector<Section> sections_;
+};
+
+// 跑reps次，按第一个指标取中位数那一次，单次的抖动不会混进对比里
+static Metrics median(int reps, const std::function<Metrics()> &run)
+{
+    std::vector<Metrics> runs;
+    for (int i = 0; i < reps; ++i)
+    {
+        runs.push_back(run());
+    }
+    std::sort(runs.begin(), runs.end(), [](const Metrics &a, const Metrics &b) {
+        return a[0].second < b[0].second;
+    });
+    return runs[runs.size() / 2];
+}
+
+static double percentile(std::vector<double> &v, double q)
+{
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(q * v.size()))];
+}
+
+// 全进程(所有线程)的上下文切换次数，主动让出加被抢占
+static long contextSwitches()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void waitDone(std::atomic_int &done, int total)
+{
+    while (done.load(std::memory_order_acquire) < total)
+    {
+        std::this_thread::yield();
+    }
+}
+
+// topology空的话start时从sysfs读
+static void setup(ThreadPool &pool, tpPattern pattern, tpSchedule schedule, tpQueue queue, tpPlacement placement = tpPlacement::NONE_,
+                  const NumaTopology &topology = NumaTopology())
+{
+    pool.setPattren(pattern);
+    pool.setSchedule(schedule);
+    pool.setQueue(queue);
+    pool.setPlacement(placement);
+    if (!topology.nodes.empty())
+    {
+        pool.setTopology(topology);
+    }
+    pool.setTaskCeiling(UINT16_MAX);
+}
+
+// 把本机的cpu对半分成两个节点，单节点的机器上也能跑到按节点分队列、跨节点溢出的路径；只有一个cpu就两个节点共用它
+static NumaTopology splitTopology()
+{
+    std::vector<int> cpus;
+    for (auto &node : NumaTopology::detect().nodes)
+    {
+        cpus.insert(cpus.end(), node.begin(), node.end());
+    }
+    if (cpus.empty())
+    {
+        cpus.push_back(0);
+    }
+    size_t half = std::max<size_t>(1, cpus.size() / 2);
+    NumaTopology topo;
+    topo.nodes.emplace_back(cpus.begin(), cpus.begin() + half);
+    topo.nodes.emplace_back(cpus.size() > half ? cpus.begin() + half : cpus.begin(), cpus.end());
+    return topo;
+}
+
+//---------------------------------------------
+
+// producers个外部线程一起提交，每个提交tasks/producers个空任务
+// 返回ops/s和平均每个任务的分配次数
+static Metrics benchSubmit(tpPattern pattern, tpSchedule schedule, tpQueue queue, int workers, int producers, int tasks,
+                           tpPlacement placement = tpPlacement::NONE_, const NumaTopology &topology = NumaTopology())
+{
+    std::atomic_int done(0);
+    ThreadPool pool;
+    setup(pool, pattern, schedule, queue, placement, topology);
+    pool.start(workers);
+
+    int each = tasks / producers;
+    long allocBegin = allocCount.load();
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> ps;
+    for (int p = 0; p < producers; ++p)
+    {
+        ps.emplace_back([&]() {
+            for (int i = 0; i < each; ++i)
+            {
+                pool.submitTask([&done]() { done.fetch_add(1, std::memory_order_release); });
+            }
+        });
+    }
+    for (auto &t : ps)
+    {
+        t.join();
+    }
+    waitDone(done, each * producers);
+    auto end = std::chrono::steady_clock::now();
+    double n = each * producers;
+    return {{"ops/s", n / std::chrono::duration<double>(end - begin).count()},
+            {"allocs/op", double(allocCount.load() - allocBegin) / n}};
+}
+
+// IO线程收结果：每个请求一个future挨个get，和submitTo放进完成队列一批批收比
+// 一轮提交window个请求，收齐了再下一轮，像一次epoll醒来解出一批请求
+static Metrics benchCompletion(bool cq, int workers, int tasks, int window)
+{
+    ThreadPool pool;
+    pool.setTaskCeiling(UINT16_MAX);
+    pool.start(workers);
+    CompletionQueue<long> queue;
+    std::vector<Future<long>> futures;
+    futures.reserve(window);
+    long sum = 0;
+
+    long allocBegin = allocCount.load();
+    auto begin = std::chrono::steady_clock::now();
+    for (int done = 0; done < tasks; done += window)
+    {
+        if (cq)
+        {
+            for (int i = 0; i < window; ++i)
+            {
+                pool.submitTo(queue, done + i, [i]() { return (long)i; });
+            }
+            for (int got = 0; got < window;)
+            {
+                got += queue.wait([&](Completion<long> &c) { sum += c.get(); }, std::chrono::milliseconds(100));
+            }
+        }
+        else
+        {
+            for (int i = 0; i < window; ++i)
+            {
+                futures.push_back(pool.submitTask([i]() { return (long)i; }));
+            }
+            for (auto &f : futures)
+            {
+                sum += f.get();
+            }
+            futures.clear();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double n = tasks / window * window;
+    if (sum < 0)
+    {
+        std::abort();
+    }
+    return {{"ops/s", n / std::chrono::duration<double>(end - begin).count()},
+            {"allocs/op", double(allocCount.load() - allocBegin) / n}};
+}
+
+// 同样是fixed、共享有锁队列，Pool是运行时选模式的ThreadPool或者模板参数定死的FixedThreadPool
+template <typename Pool>
+static Metrics benchPolicy(int workers, int tasks)
+{
+    std::atomic_int done(0);
+    Pool pool;
+    pool.setTaskCeiling(UINT16_MAX);
+    pool.start(workers);
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < tasks; ++i)
+    {
+        pool.submitTask([&done]() { done.fetch_add(1, std::memory_order_release); });
+    }
+    waitDone(done, tasks);
+    auto end = std::chrono::steady_clock::now();
+    return {{"ops/s", tasks / std::chrono::duration<double>(end - begin).count()}};
+}
+
+// 外部线程每次攒batch个任务用submitBatch一起提交，batch=1就是一个个submitTask
+static Metrics benchBatch(tpPattern pattern, tpSchedule schedule, tpQueue queue, int workers, int tasks, int batch)
+{
+    std::atomic_int done(0);
+    ThreadPool pool;
+    setup(pool, pattern, schedule, queue);
+    pool.start(workers);
+
+    auto job = [&done]() { done.fetch_add(1, std::memory_order_release); };
+    std::vector<decltype(job)> jobs(batch, job);
+    int total = (tasks + batch - 1) / batch * batch;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < total; i += batch)
+    {
+        if (batch == 1)
+        {
+            pool.submitTask(job);
+        }
+        else
+        {
+            pool.submitBatch(jobs.begin(), jobs.end());
+        }
+    }
+    waitDone(done, total);
+    auto end = std::chrono::steady_clock::now();
+    return {{"ops/s", total / std::chrono::duration<double>(end - begin).count()}};
+}
+
+// 任务里再提交子任务，二叉树展开，RPC handler里再拆分请求就是这种形态
+static void spawn(ThreadPool &pool, std::atomic_int &done, int depth)
+{
+    if (depth > 0)
+    {
+        pool.submitTask(spawn, std::ref(pool), std::ref(done), depth - 1);
+        pool.submitTask(spawn, std::ref(pool), std::ref(done), depth - 1);
+    }
+    done.fetch_add(1, std::memory_order_release);
+}
+
+static Metrics benchFanout(tpPattern pattern, tpSchedule schedule, tpQueue queue, int workers, int depth)
+{
+    std::atomic_int done(0);
+    int total = (1 << (depth + 1)) - 1;
+    ThreadPool pool;
+    setup(pool, pattern, schedule, queue);
+    pool.start(workers);
+
+    long allocBegin = allocCount.load();
+    auto begin = std::chrono::steady_clock::now();
+    pool.submitTask(spawn, std::ref(pool), std::ref(done), depth);
+    waitDone(done, total);
+    auto end = std::chrono::steady_clock::now();
+    return {{"ops/s", total / std::chrono::duration<double>(end - begin).count()},
+            {"allocs/op", double(allocCount.load() - allocBegin) / total}};
+}
+
+// 线程池闲着时，一个一个提交，测从submit到任务开始跑的延迟
+static Metrics benchLatency(tpSchedule schedule, tpQueue queue, int workers, int samples)
+{
+    ThreadPool pool;
+    setup(pool, tpPattern::FIXED_, schedule, queue);
+    pool.start(workers);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10)); // 等线程都停好
+
+    std::vector<double> lat;
+    for (int i = 0; i < samples; ++i)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto f = pool.submitTask([begin]() {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        });
+        lat.push_back(f.get());
+    }
+    return {{"p50(us)", percentile(lat, 0.5)}, {"p90(us)", percentile(lat, 0.9)}, {"p99(us)", percentile(lat, 0.99)},
+            {"p999(us)", percentile(lat, 0.999)}, {"max(us)", percentile(lat, 1.0)}};
+}
+
+// socketpair上一问一答，测一次往返的延迟
+// hop为true是老办法：reactor线程读到请求交给线程池处理，处理完再写回；false是在IO线程上直接处理
+static Metrics benchIo(bool hop, int workers, int rounds)
+{
+    IoExecutor io;
+    io.start(1);
+    ThreadPool pool;
+    setup(pool, tpPattern::FIXED_, tpSchedule::SHARED_, tpQueue::LOCKED_);
+    pool.start(workers);
+
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    io.watch(sv[0], [&](int fd) {
+        char c;
+        if (read(fd, &c, 1) != 1)
+        {
+            return;
+        }
+        if (hop)
+        {
+            pool.submitTask([fd, c]() {
+                ssize_t n = write(fd, &c, 1);
+                (void)n;
+            });
+        }
+        else
+        {
+            ssize_t n = write(fd, &c, 1);
+            (void)n;
+        }
+    });
+
+    std::vector<double> lat;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+    {
+        auto t = std::chrono::steady_clock::now();
+        char c = 'x';
+        if (write(sv[1], &c, 1) != 1 || read(sv[1], &c, 1) != 1)
+        {
+            break;
+        }
+        lat.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count());
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    io.unwatch(sv[0]);
+    close(sv[0]);
+    close(sv[1]);
+    return {{"ops/s", lat.size() / secs}, {"p50(us)", percentile(lat, 0.5)}, {"p99(us)", percentile(lat, 0.99)}};
+}
+
+// 低优先级的批量任务把线程池一直占满，同时隔一会儿提交一个探针任务
+// 测探针从提交到开始执行的延迟，探针放在批量lane里就得排在整个积压后面
+static Metrics benchLanes(tpSchedule schedule, tpQueue queue, int workers, tpPriority probe, int probes)
+{
+    const int backlog = 256;
+    std::atomic_int outstanding(0);
+    std::atomic_bool stop(false);
+    ThreadPool pool;
+    setup(pool, tpPattern::FIXED_, schedule, queue);
+    pool.start(workers);
+
+    std::thread producer([&]() {
+        while (!stop)
+        {
+            if (outstanding < backlog)
+            {
+                outstanding++;
+                pool.submitTask(tpPriority::LOW_, [&outstanding]() {
+                    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+                    while (std::chrono::steady_clock::now() < until)
+                    {
+                    }
+                    outstanding--;
+                });
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    while (outstanding < backlog)
+    {
+        std::this_thread::yield();
+    }
+
+    std::vector<double> lat;
+    for (int i = 0; i < probes; ++i)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto f = pool.submitTask(probe, [begin]() {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        });
+        lat.push_back(f.get());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    stop = true;
+    producer.join();
+    while (outstanding > 0)
+    {
+        std::this_thread::yield();
+    }
+    return {{"p50(us)", percentile(lat, 0.5)}, {"p99(us)", percentile(lat, 0.99)}};
+}
+
+// RPC那种一阵一阵的流量：很多线程闲着，每次来burst个任务，隔一会儿再来
+// 看每个任务带来几次上下文切换、几次futex，spin是停车前转的圈数
+static Metrics benchBursts(tpSchedule schedule, tpQueue queue, int workers, uint32_t spin, int bursts)
+{
+    const int burst = 8;
+    std::atomic_int done(0);
+    ThreadPool pool;
+    setup(pool, tpPattern::FIXED_, schedule, queue);
+    pool.setSpinCount(spin);
+    pool.start(workers);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10)); // 等线程都停好
+
+    long cswBegin = contextSwitches();
+    long futexBegin = futexCalls.load();
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < bursts; ++i)
+    {
+        for (int j = 0; j < burst; ++j)
+        {
+            pool.submitTask([&done]() { done.fetch_add(1, std::memory_order_release); });
+        }
+        // 等这一阵消化完，再空转一小会儿模拟两次请求之间的空档
+        waitDone(done, (i + 1) * burst);
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+        while (std::chrono::steady_clock::now() < until)
+        {
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double n = bursts * burst;
+    return {{"ops/s", n / std::chrono::duration<double>(end - begin).count()},
+            {"csw/op", (contextSwitches() - cswBegin) / n},
+            {"futex/op", (futexCalls.load() - futexBegin) / n}};
+}
+
+// 两个执行器挂在一个组上，都压着一大堆20us的任务，权重1和3
+// 跑一段时间看各自跑完了几个，比值应该接近权重比
+static Metrics benchGroupWeight(int workers, int ms)
+{
+    const int backlog = 4096;
+    PoolGroup group;
+    GroupExecutor &light = group.createExecutor({"light", 1, 0, backlog});
+    GroupExecutor &heavy = group.createExecutor({"heavy", 3, 0, backlog});
+    auto work = []() {
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+        while (std::chrono::steady_clock::now() < until)
+        {
+        }
+    };
+    for (int i = 0; i < backlog; ++i)
+    {
+        light.submitTask(work);
+        heavy.submitTask(work);
+    }
+    group.start(workers);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    double l = light.completed(), h = heavy.completed();
+    double secs = ms / 1000.0;
+    // 析构会把剩下的跑完，不计时
+    return {{"heavy/light", h / std::max(1.0, l)}, {"light(ops/s)", l / secs}, {"heavy(ops/s)", h / secs}};
+}
+
+// 吵的执行器一直塞1ms的阻塞任务(比如同步调下游)，把线程全占着；安静的执行器隔一会儿提交一个探针
+// 测探针提交到开始执行的延迟，吵的那个限了并发就给别人留着线程
+static Metrics benchGroupCap(uint32_t cap, int workers, int probes)
+{
+    const int backlog = 256;
+    std::atomic_bool stop(false);
+    PoolGroup group;
+    GroupExecutor &noisy = group.createExecutor({"noisy", 1, cap, backlog});
+    GroupExecutor &quiet = group.createExecutor({"quiet", 1, 0, TASKNUM_CEILING});
+    group.start(workers);
+
+    std::thread producer([&]() {
+        while (!stop)
+        {
+            if (noisy.queued() < backlog)
+            {
+                noisy.submitTask([]() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    });
+    while (noisy.queued() < backlog / 2)
+    {
+        std::this_thread::yield();
+    }
+
+    std::vector<double> lat;
+    for (int i = 0; i < probes; ++i)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto f = quiet.submitTask([begin]() {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        });
+        lat.push_back(f.get());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    stop = true;
+    producer.join();
+    return {{"p50(us)", percentile(lat, 0.5)}, {"p99(us)", percentile(lat, 0.99)}};
+}
+
+//---------------------------------------------
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    bool quick = false;
+    int reps = 3;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else if (std::strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+        {
+            reps = std::max(1, std::atoi(argv[++i]));
+        }
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--json] [--quick] [--reps N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int hw = std::max(1u, std::thread::hardware_concurrency());
+    const int tasks = quick ? 5000 : 20000;
+    const int depth = quick ? 10 : 12;
+    const int samples = quick ? 500 : 2000;
+    const int probes = quick ? 30 : 100;
+    const int bursts = quick ? 500 : 2000;
+    const tpSchedule schedules[] = {tpSchedule::SHARED_, tpSchedule::STEALING_};
+    const tpQueue queues[] = {tpQueue::LOCKED_, tpQueue::LOCKFREE_};
+    Report report(json);
+
+    // 空任务吞吐随线程数的变化，一个外部线程提交
+    report.section("throughput");
+    std::vector<int> workerCounts;
+    for (int w = 1; w <= std::max(4, 2 * hw); w *= 2)
+    {
+        workerCounts.push_back(w);
+    }
+    for (tpSchedule schedule : schedules)
+    {
+        for (tpQueue queue : queues)
+        {
+            for (int w : workerCounts)
+            {
+                Metrics m = median(reps, [&]() { return benchSubmit(tpPattern::FIXED_, schedule, queue, w, 1, tasks); });
+                report.add({{"schedule", scheduleName(schedule)}, {"queue", queueName(queue)}, {"workers", std::to_string(w)}}, m);
+            }
+        }
+    }
+
+    // 生产者:消费者  1:N一个分发线程喂一池子，N:1很多连接抢一个线程，N:N
+    report.section("ratio");
+    int n = std::max(4, hw);
+    const std::pair<int, int> ratios[] = {{1, n}, {n, 1}, {n, n}};
+    for (tpSchedule schedule : schedules)
+    {
+        for (tpQueue queue : queues)
+        {
+            for (auto ratio : ratios)
+            {
+                Metrics m = median(reps, [&]() { return benchSubmit(tpPattern::FIXED_, schedule, queue, ratio.second, ratio.first, tasks); });
+                report.add({{"schedule", scheduleName(schedule)}, {"queue", queueName(queue)},
+                            {"ratio", std::to_string(ratio.first) + ":" + std::to_string(ratio.second)}},
+                           m);
+            }
+        }
+    }
+
+    // 一个个提交和成批提交
+    report.section("batch");
+    for (tpSchedule schedule : schedules)
+    {
+        for (tpQueue queue : queues)
+        {
+            for (int batch : {1, 8, 32, 128})
+            {
+                Metrics m = median(reps, [&]() { return benchBatch(tpPattern::FIXED_, schedule, queue, hw, tasks, batch); });
+                report.add({{"schedule", scheduleName(schedule)}, {"queue", queueName(queue)}, {"batch", std::to_string(batch)}}, m);
+            }
+        }
+    }
+
+    // fixed和cached：外部提交、成批提交、任务里再提交
+    report.section("pattern");
+    for (tpPattern pattern : {tpPattern::FIXED_, tpPattern::CACHED_})
+    {
+        for (tpSchedule schedule : schedules)
+        {
+            for (tpQueue queue : queues)
+            {
+                Metrics ext = median(reps, [&]() { return benchSubmit(pattern, schedule, queue, hw, 1, tasks); });
+                Metrics bat = median(reps, [&]() { return benchBatch(pattern, schedule, queue, hw, tasks, 32); });
+                Metrics fan = median(reps, [&]() { return benchFanout(pattern, schedule, queue, hw, depth); });
+                report.add({{"pattern", patternName(pattern)}, {"schedule", scheduleName(schedule)}, {"queue", queueName(queue)}},
+                           {{"external(ops/s)", ext[0].second}, {"allocs/op", ext[1].second},
+                            {"batch(ops/s)", bat[0].second}, {"fanout(ops/s)", fan[0].second}, {"fanout allocs", fan[1].second}});
+            }
+        }
+    }
+
+    // 闲着的线程池，提交到开始跑的延迟分布
+    report.section("latency");
+    for (tpSchedule schedule : schedules)
+    {
+        for (tpQueue queue : queues)
+        {
+            Metrics m = median(reps, [&]() { return benchLatency(schedule, queue, hw, samples); });
+            report.add({{"schedule", scheduleName(schedule)}, {"queue", queueName(queue)}, {"workers", std::to_string(hw)}}, m);
+        }
+    }
+
+    // 一阵一阵的提交，线程数是核数的4倍，看叫醒的开销；单核机器上自旋只会抢生产者的CPU
+    report.section("bursts");
+    for (tpSchedule schedule : schedules)
+    {
+        for (tpQueue queue : queues)
+        {
+            for (uint32_t spin : {0u, SPIN_COUNT})
+            {
+                Metrics m = median(reps, [&]() { return benchBursts(schedule, queue, hw * 4, spin, bursts); });
+                report.add({{"schedule", scheduleName(schedule)}, {"queue", queueName(queue)},
+                            {"workers", std::to_string(hw * 4)}, {"spin", std::to_string(spin)}},
+                           m);
+            }
+        }
+    }
+
+    // 批量lane压满时，探针放在批量lane和高优先级lane的提交到开始执行延迟
+    report.section("lanes");
+    for (tpSchedule schedule : schedules)
+    {
+        for (tpQueue queue : queues)
+        {
+            for (tpPriority probe : {tpPriority::LOW_, tpPriority::HIGH_})
+            {
+                Metrics m = benchLanes(schedule, queue, hw, probe, probes);
+                report.add({{"schedule", scheduleName(schedule)}, {"queue", queueName(queue)},
+                            {"probe", probe == tpPriority::HIGH_ ? "high" : "low"}},
+                           m);
+            }
+        }
+    }
+
+    // 编译期定死模式、关掉统计，和运行时选同样的模式比
+    report.section("policy");
+    for (int w : {1, n})
+    {
+        Metrics m = median(reps, [&]() { return benchPolicy<ThreadPool>(w, tasks); });
+        report.add({{"pool", "runtime"}, {"workers", std::to_string(w)}}, m);
+        m = median(reps, [&]() { return benchPolicy<FixedThreadPool>(w, tasks); });
+        report.add({{"pool", "fixed"}, {"workers", std::to_string(w)}}, m);
+    }
+
+    // 按NUMA拓扑绑核、每个节点一组队列，和不绑核一组队列比
+    // sysfs读到的拓扑单节点时只能看出绑核本身的开销，再用对半分的两个节点跑一遍按节点分队列的路径
+    report.section("placement");
+    const NumaTopology sysfs = NumaTopology::detect();
+    const NumaTopology split = splitTopology();
+    for (tpQueue queue : queues)
+    {
+        Metrics m = median(reps, [&]() { return benchSubmit(tpPattern::FIXED_, tpSchedule::SHARED_, queue, n, n, tasks); });
+        report.add({{"queue", queueName(queue)}, {"placement", placementName(tpPlacement::NONE_)}, {"topology", "-"}, {"nodes", "1"}}, m);
+        for (const NumaTopology *topo : {&sysfs, &split})
+        {
+            for (tpPlacement placement : {tpPlacement::SPREAD_, tpPlacement::COMPACT_})
+            {
+                m = median(reps, [&]() { return benchSubmit(tpPattern::FIXED_, tpSchedule::SHARED_, queue, n, n, tasks, placement, *topo); });
+                report.add({{"queue", queueName(queue)}, {"placement", placementName(placement)},
+                            {"topology", topo == &sysfs ? "sysfs" : "split"}, {"nodes", std::to_string(topo->nodes.size())}},
+                           m);
+            }
+        }
+    }
+
+    // 一组线程上挂多个执行器，都忙的时候按权重分线程
+    report.section("group");
+    Metrics gm = median(reps, [&]() { return benchGroupWeight(n, quick ? 50 : 200); });
+    report.add({{"weights", "1:3"}, {"workers", std::to_string(n)}}, gm);
+
+    // 吵的执行器限了并发，同组安静的执行器不被饿着
+    report.section("isolation");
+    for (uint32_t cap : {0u, (uint32_t)n / 2})
+    {
+        Metrics m = benchGroupCap(cap, n, probes);
+        report.add({{"cap", cap == 0 ? "none" : std::to_string(cap)}, {"workers", std::to_string(n)}}, m);
+    }
+
+    // IO线程收结果：future挨个get，还是完成队列一批批收
+    report.section("completion");
+    for (bool cq : {false, true})
+    {
+        Metrics m = median(reps, [&]() { return benchCompletion(cq, n, tasks, 64); });
+        report.add({{"harvest", cq ? "queue" : "future"}}, m);
+    }
+
+    // 网络层：请求在reactor和线程池之间倒一手，和在IO线程上直接处理比
+    report.section("io");
+    for (bool hop : {true, false})
+    {
+        Metrics m = median(reps, [&]() { return benchIo(hop, hw, samples); });
+        report.add({{"handler", hop ? "pool" : "inline"}}, m);
+    }
+
+    report.finish(reps);
+}
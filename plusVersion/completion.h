@@ -0,0 +1,219 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <utility>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "mpmcqueue.h"
+
+const size_t COMPLETION_RING_SIZE = 4096; // 完成队列的环默认多大
+
+// 一个跑完的任务：提交时带的tag和结果；任务抛了异常时error不空，value是空的
+// 结果放在optional里，T不用能默认构造，能移动构造就行
+template <typename T>
+struct Completion
+{
+    uint64_t tag = 0;
+    std::optional<T> value;
+    std::exception_ptr error;
+
+    Completion() = default;
+    Completion(Completion &&) = default;
+
+    // 环里的格子是移动赋值进出的；optional自己的移动赋值还要T能移动赋值，这里先清掉再原地构造
+    Completion &operator=(Completion &&other)
+    {
+        if (this != &other)
+        {
+            tag = other.tag;
+            if (other.value)
+            {
+                value.emplace(std::move(*other.value));
+            }
+            else
+            {
+                value.reset();
+            }
+            error = std::move(other.error);
+        }
+        return *this;
+    }
+
+    bool ok() const
+    {
+        return error == nullptr;
+    }
+
+    // 任务抛的异常在这里抛出来
+    T &get()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return *value;
+    }
+};
+
+// 没有返回值的任务：只有tag和异常
+template <>
+struct Completion<void>
+{
+    uint64_t tag = 0;
+    std::exception_ptr error;
+
+    bool ok() const
+    {
+        return error == nullptr;
+    }
+
+    void get()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// 完成队列，照着io_uring的CQ做：线程池跑完submitTo提交的任务，把(tag, 结果)放进来，IO线程一次收一批
+// 一个请求不用一个future，IO线程也不用挨个get，收一轮回包一轮写完
+// 生产者是工作线程，只能有一个线程收(环是MPMCQueue，这里只当单消费者用)；环满了放进溢出队列，结果不会丢
+// 溢出队列不空时新结果也排到它后面，环里的都比溢出队列里的早，收的顺序就是放进来的顺序
+// fd()是个eventfd，有新结果时可读，可以挂到IO线程自己的epoll上；没有epoll就用wait
+// T能移动构造就行，没有返回值的任务用CompletionQueue<void>
+template <typename T>
+class CompletionQueue
+{
+public:
+    explicit CompletionQueue(size_t capacity = COMPLETION_RING_SIZE)
+        : ring_(capacity), overflowNum_(0), notified_(false)
+    {
+        evfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (evfd_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "CompletionQueue eventfd");
+        }
+    }
+
+    ~CompletionQueue()
+    {
+        close(evfd_);
+    }
+
+    int fd() const
+    {
+        return evfd_;
+    }
+
+    // 工作线程调；上次通知过还没被收走的不再写eventfd
+    void push(Completion<T> c)
+    {
+        if (overflowNum_.load(std::memory_order_acquire) > 0 || !ring_.tryPush(c))
+        {
+            std::lock_guard<std::mutex> lock(overflowMtx_);
+            overflow_.push_back(std::move(c));
+            overflowNum_.fetch_add(1, std::memory_order_release);
+        }
+        signal();
+    }
+
+    // 不阻塞，把已经完成的至多max个交给fn(Completion<T> &)，返回交了几个
+    // fd()可读时调；没收完(到了max)的下次还能收，eventfd会再置上
+    template <typename F>
+    size_t drain(F &&fn, size_t max = SIZE_MAX)
+    {
+        // 和IoExecutor::loop一样：先读eventfd，再清标记，最后收
+        // 反过来的话，清完标记到读之间生产者写的那一次会被这次读吃掉，标记却还留着，之后的结果都不再通知
+        // 用exchange不用store：和生产者的exchange配对，看到标记就看得到它之前放进来的结果
+        uint64_t cnt;
+        ssize_t r = read(evfd_, &cnt, sizeof(cnt));
+        (void)r;
+        notified_.exchange(false, std::memory_order_acq_rel);
+
+        // 环里的比溢出队列里的早，先收环
+        size_t n = 0;
+        Completion<T> c;
+        while (n < max && ring_.tryPop(c))
+        {
+            fn(c);
+            n++;
+        }
+        if (n < max && overflowNum_.load(std::memory_order_acquire) > 0)
+        {
+            std::deque<Completion<T>> batch;
+            {
+                std::lock_guard<std::mutex> lock(overflowMtx_);
+                while (n + batch.size() < max && !overflow_.empty())
+                {
+                    batch.push_back(std::move(overflow_.front()));
+                    overflow_.pop_front();
+                }
+                overflowNum_.fetch_sub(batch.size(), std::memory_order_relaxed);
+            }
+            for (Completion<T> &b : batch)
+            {
+                fn(b);
+                n++;
+            }
+        }
+        if (n == max && size() > 0)
+        {
+            signal();
+        }
+        return n;
+    }
+
+    // 没有结果时最多等timeout，有了就收一批；返回收了几个，超时返回0
+    template <typename F, typename Rep, typename Period>
+    size_t wait(F &&fn, std::chrono::duration<Rep, Period> timeout, size_t max = SIZE_MAX)
+    {
+        size_t n = drain(fn, max);
+        if (n > 0)
+        {
+            return n;
+        }
+        struct pollfd p = {evfd_, POLLIN, 0};
+        poll(&p, 1, (int)std::chrono::ceil<std::chrono::milliseconds>(timeout).count());
+        return drain(fn, max);
+    }
+
+    // 还没收的结果数，并发下只是个近似值
+    size_t size() const
+    {
+        return ring_.size() + overflowNum_.load(std::memory_order_relaxed);
+    }
+
+private:
+    void signal()
+    {
+        if (!notified_.exchange(true, std::memory_order_acq_rel))
+        {
+            uint64_t one = 1;
+            ssize_t n = write(evfd_, &one, sizeof(one));
+            (void)n;
+        }
+    }
+
+    MPMCQueue<Completion<T>> ring_;
+    std::mutex overflowMtx_;
+    std::deque<Completion<T>> overflow_; // 环满了放这，IO线程收得慢时才会用到
+    std::atomic<size_t> overflowNum_;
+    std::atomic_bool notified_; // 写过eventfd还没被drain清掉
+    int evfd_;
+
+    // noncopyable
+    CompletionQueue(const CompletionQueue &) = delete;
+    void operator=(const CompletionQueue &) = delete;
+};
@@ -0,0 +1,88 @@
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "threadpool.h"
+
+// 协程用法演示，要-std=c++20：make coro && ./coro
+// 跑一遍schedule、pool_task套pool_task、co_await Future和异常，结果不对直接返回非0
+#ifndef TP_COROUTINES
+#error "coro.cc needs C++20 coroutines, build with -std=c++20"
+#endif
+
+// 一次RPC调用：提交到线程池，co_await它的Future，等的时候不占线程
+pool_task<int> rpc(ThreadPool &pool, int x)
+{
+    int doubled = co_await pool.submitTask([x]() { return x * 2; });
+    co_return doubled + 1;
+}
+
+// 套着调：子协程对称转移回来，不往栈上叠
+pool_task<int> fanIn(ThreadPool &pool, int n)
+{
+    co_await pool.schedule(); // 从这开始在工作线程上跑
+    int sum = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        sum += co_await rpc(pool, i);
+    }
+    co_return sum;
+}
+
+pool_task<void> fail(ThreadPool &pool)
+{
+    co_await pool.schedule();
+    throw std::runtime_error("handler failed");
+}
+
+int main()
+{
+    ThreadPool pool;
+    pool.setTaskCeiling(4096);
+    pool.start(4);
+    int bad = 0;
+
+    // 1. 非协程代码用spawn拿Future
+    int sum = pool.spawn(fanIn(pool, 100)).get();
+    std::cout << "fan in: " << sum << std::endl;
+    bad += sum != 100 * 99 + 100; // sum(2i+1)
+
+    // 2. 一千个协程同时在等，只有4个线程
+    std::vector<Future<int>> many;
+    for (int i = 0; i < 1000; ++i)
+    {
+        many.push_back(pool.spawn(rpc(pool, i)));
+    }
+    long total = 0;
+    for (auto &f : many)
+    {
+        total += f.get();
+    }
+    std::cout << "1000 coroutines: " << total << std::endl;
+    bad += total != 1000L * 999 + 1000;
+
+    // 3. 协程里抛的异常从Future::get出来
+    try
+    {
+        pool.spawn(fail(pool)).get();
+        bad++;
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cout << "exception: " << e.what() << std::endl;
+    }
+
+    // 4. schedule之后确实在池里的线程上
+    std::atomic_bool inPool(false);
+    auto where = [&]() -> pool_task<void> {
+        co_await pool.schedule();
+        inPool = pool.inWorker();
+    };
+    pool.spawn(where()).get();
+    std::cout << "resumed on worker: " << inPool << std::endl;
+    bad += !inPool;
+
+    return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+// C++20协程支持：co_await pool.schedule()切到线程池上接着跑，pool_task<T>当协程的返回类型
+// 挂起的协程只是一个coroutine_handle，直接塞进运行队列，工作线程取出来resume，不套packaged_task
+// 几千个在等RPC的协程只占几个线程；编译器不支持协程(比如-std=c++17)时这个文件什么都不定义
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#define TP_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "future.h"
+
+// co_await schedule_on(ex)之后的代码在ex上跑
+class ScheduleAwaiter
+{
+public:
+    explicit ScheduleAwaiter(Executor &ex) : ex_(ex)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    // post可能直接在当前线程跑(队列满了)，那协程在这里就接着跑完了，之后不能再碰this
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        ex_.post([h]() {
+            h.resume();
+        });
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+
+private:
+    Executor &ex_;
+};
+
+inline ScheduleAwaiter schedule_on(Executor &ex)
+{
+    return ScheduleAwaiter(ex);
+}
+
+//---------------------------------------------
+
+template <typename T = void>
+class pool_task;
+
+// 协程跑完回到co_await它的那个协程，对称转移，不往栈上叠
+struct PoolTaskFinal
+{
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+    {
+        std::coroutine_handle<> cont = h.promise().cont_;
+        return cont ? cont : std::noop_coroutine();
+    }
+    void await_resume() const noexcept
+    {
+    }
+};
+
+struct PoolTaskPromiseBase
+{
+    std::suspend_always initial_suspend() const noexcept
+    {
+        return {}; // 懒启动，co_await的时候才开始跑
+    }
+    PoolTaskFinal final_suspend() const noexcept
+    {
+        return {};
+    }
+    void unhandled_exception() noexcept
+    {
+        error_ = std::current_exception();
+    }
+
+    std::coroutine_handle<> cont_; // 等着结果的协程
+    std::exception_ptr error_;
+};
+
+template <typename T>
+struct PoolTaskPromise : PoolTaskPromiseBase
+{
+    pool_task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U &&v)
+    {
+        value_.emplace(std::forward<U>(v));
+    }
+
+    T take()
+    {
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        return std::move(*value_);
+    }
+
+    std::optional<T> value_;
+};
+
+template <>
+struct PoolTaskPromise<void> : PoolTaskPromiseBase
+{
+    pool_task<void> get_return_object() noexcept;
+
+    void return_void() noexcept
+    {
+    }
+
+    void take()
+    {
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+    }
+};
+
+// 协程返回类型，只能移动；co_await它才开始跑，在co_await的那个线程上跑
+// 想换线程就在协程里先co_await pool.schedule()；不在协程里就用pool.spawn拿Future
+template <typename T>
+class pool_task
+{
+public:
+    using promise_type = PoolTaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    pool_task() noexcept : h_(nullptr)
+    {
+    }
+    explicit pool_task(Handle h) noexcept : h_(h)
+    {
+    }
+    pool_task(pool_task &&other) noexcept : h_(other.h_)
+    {
+        other.h_ = nullptr;
+    }
+    pool_task &operator=(pool_task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            h_ = other.h_;
+            other.h_ = nullptr;
+        }
+        return *this;
+    }
+    ~pool_task()
+    {
+        reset();
+    }
+
+    bool valid() const noexcept
+    {
+        return h_ != nullptr;
+    }
+
+    struct Awaiter
+    {
+        bool await_ready() const noexcept
+        {
+            return h.done();
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept
+        {
+            h.promise().cont_ = cont;
+            return h;
+        }
+        T await_resume()
+        {
+            return h.promise().take();
+        }
+
+        Handle h;
+    };
+
+    Awaiter operator co_await() const noexcept
+    {
+        return Awaiter{h_};
+    }
+
+private:
+    void reset()
+    {
+        if (h_)
+        {
+            h_.destroy();
+            h_ = nullptr;
+        }
+    }
+
+    Handle h_;
+
+    // noncopyable
+    pool_task(const pool_task &) = delete;
+    void operator=(const pool_task &) = delete;
+};
+
+template <typename T>
+pool_task<T> PoolTaskPromise<T>::get_return_object() noexcept
+{
+    return pool_task<T>(std::coroutine_handle<PoolTaskPromise<T>>::from_promise(*this));
+}
+
+inline pool_task<void> PoolTaskPromise<void>::get_return_object() noexcept
+{
+    return pool_task<void>(std::coroutine_handle<PoolTaskPromise<void>>::from_promise(*this));
+}
+
+//---------------------------------------------
+
+// co_await一个Future：就绪前挂起，不占线程；结果从提交它的线程池上接着跑(没有就在完成的线程上)
+// 和get一样只能等一次
+template <typename T>
+class FutureAwaiter
+{
+public:
+    explicit FutureAwaiter(Future<T> &f) : f_(f)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return f_.ready();
+    }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        Executor *ex = f_.executor();
+        Future<T> &f = f_;
+        f_.on_ready([&f, ex, h](Future<T> done) {
+            f = std::move(done);
+            if (ex != nullptr)
+            {
+                ex->post([h]() {
+                    h.resume();
+                });
+            }
+            else
+            {
+                h.resume();
+            }
+        });
+    }
+
+    T await_resume()
+    {
+        return f_.get();
+    }
+
+private:
+    Future<T> &f_;
+};
+
+template <typename T>
+FutureAwaiter<T> operator co_await(Future<T> &f)
+{
+    return FutureAwaiter<T>(f);
+}
+
+template <typename T>
+FutureAwaiter<T> operator co_await(Future<T> &&f)
+{
+    return FutureAwaiter<T>(f); // 临时对象活到整个co_await表达式结束
+}
+
+//---------------------------------------------
+
+// 跑完自己销毁的协程，co_spawn拿它把pool_task挂到executor上
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() const noexcept
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() const noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() const noexcept
+        {
+            return {};
+        }
+        void return_void() const noexcept
+        {
+        }
+        void unhandled_exception() const noexcept
+        {
+            std::terminate(); // 异常都在下面交给promise了，走不到这
+        }
+    };
+};
+
+template <typename T>
+DetachedTask runDetached(Executor &ex, pool_task<T> task, Promise<T> promise)
+{
+    co_await schedule_on(ex);
+    try
+    {
+        if constexpr (std::is_void<T>::value)
+        {
+            co_await task;
+            promise.set_value();
+        }
+        else
+        {
+            promise.set_value(co_await task);
+        }
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+// 在ex上开始跑task，结果放进返回的Future；非协程代码从这里进协程的世界
+template <typename T>
+Future<T> co_spawn(Executor &ex, pool_task<T> task)
+{
+    Promise<T> promise;
+    promise.setExecutor(&ex);
+    Future<T> result = promise.get_future();
+    runDetached(ex, std::move(task), std::move(promise));
+    return result;
+}
+
+#endif
@@ -0,0 +1,826 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "task.h"
+
+// 压测时定义TP_COUNT_FUTEX，数一数进了几次内核；平时什么都不做
+#ifdef TP_COUNT_FUTEX
+inline std::atomic<long> futexCalls(0);
+#define TP_FUTEX_CALLED() futexCalls.fetch_add(1, std::memory_order_relaxed)
+#else
+#define TP_FUTEX_CALLED()
+#endif
+
+// c++17还没有atomic::wait，直接用futex，word的值还是expected才睡
+inline void futexWait(std::atomic<uint32_t> &word, uint32_t expected)
+{
+    TP_FUTEX_CALLED();
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+// 最多睡timeout，超时、被叫醒、word已经变了都会返回
+inline void futexWaitFor(std::atomic<uint32_t> &word, uint32_t expected, std::chrono::nanoseconds timeout)
+{
+    TP_FUTEX_CALLED();
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000000000;
+    ts.tv_nsec = timeout.count() % 1000000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+}
+inline void futexWakeOne(std::atomic<uint32_t> &word)
+{
+    TP_FUTEX_CALLED();
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+inline void futexWakeAll(std::atomic<uint32_t> &word)
+{
+    TP_FUTEX_CALLED();
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// 自旋等待时每圈歇一下，让出流水线(超线程的兄弟核能跑得快点)
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+//---------------------------------------------
+
+// 对象池：每个线程一个空闲链表，攒多了成批还给全局仓库，空了成批从仓库拿
+// 一批只加一次锁；对象在A线程创建、B线程释放这种来回流动也不会一直new
+// Node需要有默认构造和一个Node *next_成员
+template <typename Node>
+class NodePool
+{
+public:
+    static Node *get()
+    {
+        Cache &c = cache();
+        if (c.head == nullptr)
+        {
+            depot().take(c);
+        }
+        if (c.head == nullptr)
+        {
+            return new Node();
+        }
+        Node *n = c.head;
+        c.head = n->next_;
+        c.size--;
+        return n;
+    }
+
+    static void put(Node *n)
+    {
+        Cache &c = cache();
+        n->next_ = c.head;
+        c.head = n;
+        c.size++;
+        if (c.size >= 2 * BATCH)
+        {
+            depot().give(c, BATCH);
+        }
+    }
+
+private:
+    static const int BATCH = 64;
+    static const int DEPOT_CEILING = 64 * 1024; // 仓库里最多留这么多，再多就真释放
+
+    struct Cache
+    {
+        Node *head = nullptr;
+        int size = 0;
+        ~Cache()
+        {
+            depot().give(*this, size); // 线程退出，手里的都还回去
+        }
+    };
+
+    struct Depot
+    {
+        std::mutex mtx;
+        Node *head = nullptr;
+        int size = 0;
+
+        void give(Cache &c, int num)
+        {
+            if (num <= 0)
+            {
+                return;
+            }
+            // 锁外先把要还的一段摘下来
+            Node *first = c.head;
+            Node *last = first;
+            for (int i = 1; i < num; ++i)
+            {
+                last = last->next_;
+            }
+            c.head = last->next_;
+            c.size -= num;
+
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (size + num <= DEPOT_CEILING)
+                {
+                    last->next_ = head;
+                    head = first;
+                    size += num;
+                    return;
+                }
+            }
+            last->next_ = nullptr;
+            while (first != nullptr)
+            {
+                Node *next = first->next_;
+                delete first;
+                first = next;
+            }
+        }
+
+        void take(Cache &c)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (int i = 0; i < BATCH && head != nullptr; ++i)
+            {
+                Node *n = head;
+                head = n->next_;
+                size--;
+                n->next_ = c.head;
+                c.head = n;
+                c.size++;
+            }
+        }
+    };
+
+    static Cache &cache()
+    {
+        thread_local Cache c;
+        return c;
+    }
+    static Depot &depot()
+    {
+        static Depot *d = new Depot(); // 故意不释放，detach的线程可能比main活得久
+        return *d;
+    }
+};
+
+//---------------------------------------------
+
+// 续体往哪调度：线程池、strand这类东西实现它；then没有executor就在完成的线程上直接跑
+// 不通过Executor*删除，析构函数不是虚的；实现它的类都标final，用户按具体类型new/delete不会报-Wdelete-non-virtual-dtor
+class Executor
+{
+public:
+    virtual void post(InlineTask fn) = 0;
+
+    // 当前线程是不是自己的工作线程；是的话等结果时不睡，帮着跑排队的任务，fixed模式嵌套等待也不会锁死
+    virtual bool inWorker() const
+    {
+        return false;
+    }
+    // 在当前线程上跑一个排队的任务，没有可跑的返回false
+    virtual bool runPending()
+    {
+        return false;
+    }
+
+protected:
+    ~Executor() = default;
+};
+
+const int HELP_WAIT_US = 100; // 工作线程等结果时找不到活干，最多睡这么久再去找
+
+// 在工作线程上等到done：有排队的任务就先跑，没有就sleep短睡一会儿，等的东西可能马上被别的线程排进来
+// 不在工作线程上返回false，调用者自己正常睡
+template <typename Done, typename Sleep>
+inline bool helpWhileWaiting(Executor *ex, Done done, Sleep sleep)
+{
+    if (ex == nullptr || !ex->inWorker())
+    {
+        return false;
+    }
+    while (!done())
+    {
+        if (!ex->runPending())
+        {
+            sleep(std::chrono::microseconds(HELP_WAIT_US));
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------
+
+// Future和Promise共享的状态，引用计数归零后回到NodePool，不还给系统
+template <typename T>
+class SharedState
+{
+public:
+    // 引用类型的结果存成reference_wrapper，void随便占个位置
+    using Val = typename std::conditional<std::is_void<T>::value, char,
+                                          typename std::conditional<std::is_lvalue_reference<T>::value,
+                                                                    std::reference_wrapper<typename std::remove_reference<T>::type>,
+                                                                    T>::type>::type;
+
+    static SharedState *create()
+    {
+        SharedState *s = NodePool<SharedState>::get();
+        s->word_.store(EMPTY, std::memory_order_relaxed);
+        s->refs_.store(1, std::memory_order_relaxed);
+        s->hasValue_ = false;
+        s->ex_ = nullptr;
+        s->executor_ = nullptr;
+        return s;
+    }
+
+    void addRef()
+    {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release()
+    {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            if (hasValue_)
+            {
+                value()->~Val();
+                hasValue_ = false;
+            }
+            ex_ = nullptr;
+            NodePool<SharedState>::put(this);
+        }
+    }
+
+    bool ready() const
+    {
+        return word_.load(std::memory_order_acquire) & READY;
+    }
+
+    void wait()
+    {
+        // RPC里结果多半早就好了，先看几眼再睡
+        for (int i = 0; i < SPIN; ++i)
+        {
+            if (ready())
+            {
+                return;
+            }
+        }
+        // 线程池自己的线程在等池里的任务：帮着跑，不占着线程睡
+        if (helpWhileWaiting(executor_, [this]() { return ready(); }, [this](std::chrono::nanoseconds timeout) {
+                uint32_t w = word_.load(std::memory_order_acquire);
+                if (!(w & READY) && (w & WAITING || word_.compare_exchange_strong(w, w | WAITING, std::memory_order_acquire)))
+                {
+                    futexWaitFor(word_, w | WAITING, timeout);
+                }
+            }))
+        {
+            return;
+        }
+        uint32_t w = word_.load(std::memory_order_acquire);
+        while (!(w & READY))
+        {
+            // 先挂上WAITING，complete看到了才会去futex唤醒
+            if (!(w & WAITING))
+            {
+                if (!word_.compare_exchange_weak(w, w | WAITING, std::memory_order_acquire))
+                {
+                    continue;
+                }
+                w |= WAITING;
+            }
+            futexWait(word_, w);
+            w = word_.load(std::memory_order_acquire);
+        }
+    }
+
+    // 就绪时在完成的线程上调fn，已经就绪就马上在当前线程调；只能挂一个
+    void setContinuation(InlineTask fn)
+    {
+        cont_ = std::move(fn);
+        uint32_t w = word_.load(std::memory_order_acquire);
+        while (!(w & READY))
+        {
+            if (word_.compare_exchange_weak(w, w | CONTINUATION, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return; // complete会看到CONTINUATION
+            }
+        }
+        runContinuation();
+    }
+
+    Executor *executor() const
+    {
+        return executor_;
+    }
+    void setExecutor(Executor *ex)
+    {
+        executor_ = ex;
+    }
+
+    template <typename... U>
+    void setValue(U &&...v)
+    {
+        if constexpr (!std::is_void<T>::value)
+        {
+            new (storage_) Val(std::forward<U>(v)...);
+            hasValue_ = true;
+        }
+        complete();
+    }
+
+    void setException(std::exception_ptr ex)
+    {
+        ex_ = std::move(ex);
+        complete();
+    }
+
+    // 就绪后调用，有异常就抛出来
+    T take()
+    {
+        if (ex_)
+        {
+            std::rethrow_exception(ex_);
+        }
+        if constexpr (!std::is_void<T>::value)
+        {
+            return std::move(*value());
+        }
+    }
+
+    // 引用计数的RAII，get()里抛异常也能释放
+    struct Releaser
+    {
+        void operator()(SharedState *s) const
+        {
+            s->release();
+        }
+    };
+
+private:
+    template <typename Node>
+    friend class NodePool;
+
+    SharedState() = default;
+    ~SharedState() = default;
+
+    void complete()
+    {
+        // 只有真的有人在睡才进内核
+        uint32_t old = word_.exchange(READY, std::memory_order_acq_rel);
+        if (old & WAITING)
+        {
+            futexWakeAll(word_);
+        }
+        if (old & CONTINUATION)
+        {
+            runContinuation();
+        }
+    }
+
+    void runContinuation()
+    {
+        InlineTask fn = std::move(cont_);
+        fn(); // 里面可能把最后一个引用放掉，之后不能再碰this
+    }
+
+    Val *value()
+    {
+        return std::launder(reinterpret_cast<Val *>(storage_));
+    }
+
+    static const uint32_t EMPTY = 0;
+    static const uint32_t READY = 1;
+    static const uint32_t WAITING = 2;
+    static const uint32_t CONTINUATION = 4; // 挂了续体
+    static const int SPIN = 64;
+
+    std::atomic<uint32_t> word_; // 完成状态，futex等在这上面
+    std::atomic_int refs_;
+    bool hasValue_;
+    std::exception_ptr ex_;
+    InlineTask cont_;     // then/when_all挂的续体
+    Executor *executor_;  // 续体默认往哪调度，线程池提交的任务是线程池
+    alignas(Val) unsigned char storage_[sizeof(Val)];
+    SharedState *next_ = nullptr; // 在NodePool空闲链表里时用
+};
+
+//---------------------------------------------
+
+template <typename T>
+class Promise;
+
+// then(fn)的返回类型：fn收T，void的话不收参数
+template <typename T, typename F>
+struct ThenResult
+{
+    using type = typename std::invoke_result<F, T>::type;
+};
+template <typename F>
+struct ThenResult<void, F>
+{
+    using type = typename std::invoke_result<F>::type;
+};
+
+// 用法和std::future差不多，get只能调一次
+template <typename T>
+class Future
+{
+public:
+    using TryType = typename std::conditional<std::is_void<T>::value, bool, std::optional<typename SharedState<T>::Val>>::type;
+
+    Future() : state_(nullptr)
+    {
+    }
+    explicit Future(SharedState<T> *state) : state_(state)
+    {
+    }
+    Future(Future &&other) noexcept : state_(other.state_)
+    {
+        other.state_ = nullptr;
+    }
+    Future &operator=(Future &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            state_ = other.state_;
+            other.state_ = nullptr;
+        }
+        return *this;
+    }
+    ~Future()
+    {
+        reset();
+    }
+
+    bool valid() const
+    {
+        return state_ != nullptr;
+    }
+
+    // 不阻塞，结果(或异常)好了就是true
+    bool ready() const
+    {
+        return state_->ready();
+    }
+
+    void wait() const
+    {
+        state_->wait();
+    }
+
+    T get()
+    {
+        state_->wait();
+        std::unique_ptr<SharedState<T>, typename SharedState<T>::Releaser> guard(state_);
+        state_ = nullptr;
+        return guard->take();
+    }
+
+    // 就绪后把结果交给fn，fn的返回值(或异常)放进返回的future；这个future作废
+    // fn调度到线程池(提交这个任务的那个)上跑，等的时候不占线程；上游的异常直接传下去，不调fn
+    template <typename F>
+    auto then(F &&fn) -> Future<typename ThenResult<T, F>::type>
+    {
+        return thenOn(state_->executor(), std::forward<F>(fn));
+    }
+
+    // 指定fn在哪跑
+    template <typename F>
+    auto then(Executor &ex, F &&fn) -> Future<typename ThenResult<T, F>::type>
+    {
+        return thenOn(&ex, std::forward<F>(fn));
+    }
+
+    // 就绪时在完成的线程上直接调fn(Future<T>)，不调度；fn要短，不能阻塞
+    // when_all/when_any用这个收结果，这个future作废
+    template <typename F>
+    void on_ready(F &&fn)
+    {
+        SharedState<T> *s = state_;
+        state_ = nullptr;
+        s->setContinuation(InlineTask([s, fn = std::forward<F>(fn)]() mutable {
+            fn(Future<T>(s));
+        }));
+    }
+
+    Executor *executor() const
+    {
+        return state_->executor();
+    }
+
+    // 不阻塞，没好返回空(void版本返回false)，好了就和get一样取走结果
+    TryType try_get()
+    {
+        if (!ready())
+        {
+            return TryType();
+        }
+        if constexpr (std::is_void<T>::value)
+        {
+            get();
+            return true;
+        }
+        else
+        {
+            return TryType(get());
+        }
+    }
+
+private:
+    template <typename F>
+    auto thenOn(Executor *ex, F &&fn) -> Future<typename ThenResult<T, F>::type>
+    {
+        using R = typename ThenResult<T, F>::type;
+        Promise<R> promise;
+        promise.setExecutor(ex); // 接着then下去的也在同一个地方跑
+        Future<R> result = promise.get_future();
+        on_ready([ex, promise = std::move(promise), fn = std::forward<F>(fn)](Future<T> f) mutable {
+            InlineTask run([f = std::move(f), promise = std::move(promise), fn = std::move(fn)]() mutable {
+                promise.setWith([&]() -> R {
+                    if constexpr (std::is_void<T>::value)
+                    {
+                        f.get();
+                        return fn();
+                    }
+                    else
+                    {
+                        return fn(f.get());
+                    }
+                });
+            });
+            if (ex != nullptr)
+            {
+                ex->post(std::move(run));
+            }
+            else
+            {
+                run();
+            }
+        });
+        return result;
+    }
+
+    void reset()
+    {
+        if (state_ != nullptr)
+        {
+            state_->release();
+            state_ = nullptr;
+        }
+    }
+
+    SharedState<T> *state_;
+
+    // noncopyable
+    Future(const Future &) = delete;
+    void operator=(const Future &) = delete;
+};
+
+template <typename T>
+class Promise
+{
+public:
+    Promise() : state_(SharedState<T>::create())
+    {
+    }
+    Promise(Promise &&other) noexcept : state_(other.state_)
+    {
+        other.state_ = nullptr;
+    }
+    Promise &operator=(Promise &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            state_ = other.state_;
+            other.state_ = nullptr;
+        }
+        return *this;
+    }
+    ~Promise()
+    {
+        reset();
+    }
+
+    // 只能调一次
+    Future<T> get_future()
+    {
+        state_->addRef();
+        return Future<T>(state_);
+    }
+
+    template <typename... U>
+    void set_value(U &&...v)
+    {
+        state_->setValue(std::forward<U>(v)...);
+    }
+
+    void set_exception(std::exception_ptr ex)
+    {
+        state_->setException(std::move(ex));
+    }
+
+    // future上then默认往哪调度
+    void setExecutor(Executor *ex)
+    {
+        state_->setExecutor(ex);
+    }
+
+    // 跑f，把返回值或者异常放进共享状态
+    template <typename F>
+    void setWith(F &&f)
+    {
+        try
+        {
+            if constexpr (std::is_void<T>::value)
+            {
+                f();
+                set_value();
+            }
+            else
+            {
+                set_value(f());
+            }
+        }
+        catch (...)
+        {
+            set_exception(std::current_exception());
+        }
+    }
+
+private:
+    void reset()
+    {
+        if (state_ != nullptr)
+        {
+            // 任务没执行就被丢掉了(比如线程池退出)，别让get永远等下去
+            if (!state_->ready())
+            {
+                state_->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+            state_->release();
+            state_ = nullptr;
+        }
+    }
+
+    SharedState<T> *state_;
+
+    // noncopyable
+    Promise(const Promise &) = delete;
+    void operator=(const Promise &) = delete;
+};
+
+//---------------------------------------------
+
+// 全部就绪后就绪，结果按输入的顺序；有一个抛异常就带着第一个异常就绪，不等别的
+// 收结果是在完成的线程上顺手做的，等的时候不占线程；返回的future的then跟着第一个输入调度
+template <typename T>
+auto when_all(std::vector<Future<T>> fs) -> Future<typename std::conditional<std::is_void<T>::value, void, std::vector<T>>::type>
+{
+    using Out = typename std::conditional<std::is_void<T>::value, void, std::vector<T>>::type;
+    using Slot = typename std::conditional<std::is_void<T>::value, char, std::optional<T>>::type;
+    struct State
+    {
+        std::vector<Slot> vals;
+        std::atomic<size_t> left;
+        std::atomic_bool failed{false};
+        Promise<Out> promise;
+    };
+    auto st = std::make_shared<State>();
+    st->vals.resize(fs.size());
+    st->left = fs.size();
+    if (!fs.empty())
+    {
+        st->promise.setExecutor(fs[0].executor());
+    }
+    Future<Out> result = st->promise.get_future();
+    if (fs.empty())
+    {
+        if constexpr (std::is_void<T>::value)
+        {
+            st->promise.set_value();
+        }
+        else
+        {
+            st->promise.set_value(Out());
+        }
+        return result;
+    }
+
+    for (size_t i = 0; i < fs.size(); ++i)
+    {
+        fs[i].on_ready([st, i](Future<T> f) {
+            try
+            {
+                if constexpr (std::is_void<T>::value)
+                {
+                    f.get();
+                }
+                else
+                {
+                    st->vals[i].emplace(f.get());
+                }
+            }
+            catch (...)
+            {
+                if (!st->failed.exchange(true))
+                {
+                    st->promise.set_exception(std::current_exception());
+                }
+            }
+            // 最后一个到的收尾；各个输入写的是不同的下标，fetch_sub的acq_rel保证都看得见
+            if (st->left.fetch_sub(1, std::memory_order_acq_rel) == 1 && !st->failed)
+            {
+                if constexpr (std::is_void<T>::value)
+                {
+                    st->promise.set_value();
+                }
+                else
+                {
+                    Out out;
+                    out.reserve(st->vals.size());
+                    for (auto &v : st->vals)
+                    {
+                        out.push_back(std::move(*v));
+                    }
+                    st->promise.set_value(std::move(out));
+                }
+            }
+        });
+    }
+    return result;
+}
+
+// 第一个就绪的，返回它的下标和结果(void只返回下标)；第一个是异常就带着异常就绪
+template <typename T>
+auto when_any(std::vector<Future<T>> fs) -> Future<typename std::conditional<std::is_void<T>::value, size_t, std::pair<size_t, T>>::type>
+{
+    using Out = typename std::conditional<std::is_void<T>::value, size_t, std::pair<size_t, T>>::type;
+    struct State
+    {
+        std::atomic_bool done{false};
+        Promise<Out> promise;
+    };
+    auto st = std::make_shared<State>();
+    if (!fs.empty())
+    {
+        st->promise.setExecutor(fs[0].executor());
+    }
+    Future<Out> result = st->promise.get_future();
+    if (fs.empty())
+    {
+        st->promise.set_exception(std::make_exception_ptr(std::invalid_argument("when_any of nothing")));
+        return result;
+    }
+
+    for (size_t i = 0; i < fs.size(); ++i)
+    {
+        fs[i].on_ready([st, i](Future<T> f) {
+            if (st->done.exchange(true))
+            {
+                return; // 晚到的结果直接扔掉
+            }
+            st->promise.setWith([&]() -> Out {
+                if constexpr (std::is_void<T>::value)
+                {
+                    f.get();
+                    return i;
+                }
+                else
+                {
+                    return Out(i, f.get());
+                }
+            });
+        });
+    }
+    return result;
+}
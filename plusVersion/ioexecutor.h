@@ -0,0 +1,387 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "future.h"
+#include "log.h"
+#include "numa.h"
+#include "task.h"
+
+const int IO_MAX_EVENTS = 128; // 一次epoll_wait最多取几个事件
+
+// fd可读/可写时在它所属的线程上调，参数是fd
+using IoCallback = std::function<void(int)>;
+
+// 每个线程一个epoll循环的executor，给RPC网络层用
+// fd注册到某个线程上，之后它的读写回调、post到这个线程的任务都在同一个线程(绑核时同一个核)上跑，不用跨线程倒手
+// 别的线程post任务是放进那个线程的队列再写一下它的eventfd，已经通知过还没处理的不再写
+// 用法和ThreadPool一样：先set再start，析构时停掉所有线程；epoll是水平触发的
+class IoExecutor final : public Executor
+{
+public:
+    IoExecutor() : next_(0), started_(false)
+    {
+    }
+
+    ~IoExecutor()
+    {
+        for (auto &w : workers_)
+        {
+            w->stop.store(true, std::memory_order_relaxed);
+            wake(*w);
+        }
+        for (auto &w : workers_)
+        {
+            w->thread.join();
+        }
+        // 停下来之后还没跑的任务在这跑掉，unwatch推迟的删除也在里面；任务里可能还会post
+        bool more = true;
+        while (more)
+        {
+            more = false;
+            for (auto &w : workers_)
+            {
+                std::deque<InlineTask> batch;
+                {
+                    std::lock_guard<std::mutex> lock(w->mtx);
+                    batch.swap(w->tasks);
+                }
+                more = more || !batch.empty();
+                for (InlineTask &t : batch)
+                {
+                    runSafely(t);
+                }
+            }
+        }
+    }
+
+    // 第i个线程绑cpuSets[i % n]，不设就不绑
+    void setCpuSets(std::vector<std::vector<int>> cpuSets)
+    {
+        if (started_)
+            return;
+        cpuSets_ = std::move(cpuSets);
+    }
+
+    void start(int threadsNum = std::thread::hardware_concurrency())
+    {
+        if (started_)
+            return;
+        started_ = true;
+        if (threadsNum < 1)
+        {
+            threadsNum = 1;
+        }
+        for (int i = 0; i < threadsNum; ++i)
+        {
+            auto w = std::make_unique<Worker>();
+            w->epfd = epoll_create1(EPOLL_CLOEXEC);
+            w->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (w->epfd < 0 || w->evfd < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "IoExecutor start");
+            }
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr; // nullptr表示eventfd
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev);
+            if (!cpuSets_.empty())
+            {
+                w->cpus = cpuSets_[i % cpuSets_.size()];
+            }
+            workers_.push_back(std::move(w));
+        }
+        for (int i = 0; i < threadsNum; ++i)
+        {
+            workers_[i]->thread = std::thread(&IoExecutor::loop, this, i);
+        }
+    }
+
+    int threads() const
+    {
+        return workers_.size();
+    }
+
+    // 在工作线程上post就放进自己的队列，不用写eventfd；外部线程轮流分给各个线程
+    void post(InlineTask fn) override
+    {
+        int i = curIo_ == this ? curWorker_ : (int)(next_.fetch_add(1, std::memory_order_relaxed) % workers_.size());
+        postTo(i, std::move(fn));
+    }
+
+    // 指定线程跑，比如交给某个连接所在的线程
+    void postTo(int worker, InlineTask fn)
+    {
+        Worker &w = *workers_[worker];
+        {
+            std::lock_guard<std::mutex> lock(w.mtx);
+            w.tasks.push_back(std::move(fn));
+        }
+        if (curIo_ != this || curWorker_ != worker)
+        {
+            wake(w);
+        }
+    }
+
+    // 把fd挂到worker上(-1按fd分)，返回挂到了哪个线程，失败返回-1(errno是epoll_ctl的)
+    // onRead在可读、对端关闭、出错时调；onWrite只在setWritable(fd, true)之后可写时调
+    // 同一个fd只能watch一次，close之前要先unwatch
+    int watch(int fd, IoCallback onRead, IoCallback onWrite = nullptr, int worker = -1)
+    {
+        if (worker < 0)
+        {
+            worker = fd % workers_.size();
+        }
+        Worker &w = *workers_[worker];
+        Handler *h = new Handler{fd, worker, false, std::move(onRead), std::move(onWrite)};
+        std::lock_guard<std::mutex> lock(w.mtx); // 和setWritable一样拿着锁调epoll_ctl，进了表别人才找得到它
+        if (!ctl(w, EPOLL_CTL_ADD, h, false))
+        {
+            int err = errno;
+            delete h;
+            errno = err;
+            return -1;
+        }
+        w.handlers[fd] = h;
+        return worker;
+    }
+
+    // 要不要关心可写，发送缓冲满了打开，写完了关掉，不然水平触发会一直报可写；fd没watch或者已经unwatch了返回false
+    bool setWritable(int fd, bool on)
+    {
+        for (auto &w : workers_)
+        {
+            // 拿着锁改：unwatch要在这把锁里把Handler摘掉才会推迟删除，改的时候它一定还在
+            std::lock_guard<std::mutex> lock(w->mtx);
+            auto it = w->handlers.find(fd);
+            if (it != w->handlers.end())
+            {
+                return ctl(*w, EPOLL_CTL_MOD, it->second, on);
+            }
+        }
+        return false;
+    }
+
+    // 之后不会再调这个fd的回调(别的线程unwatch时，正在跑的那次回调不管)
+    // Handler推迟到它的线程这一轮事件处理完再删，这一轮里已经取出来的事件还指着它
+    void unwatch(int fd)
+    {
+        Handler *h = take(fd); // 两个线程同时unwatch只有一个拿得到
+        if (h == nullptr)
+        {
+            return;
+        }
+        Worker &w = *workers_[h->worker];
+        h->dead.store(true, std::memory_order_relaxed);
+        epoll_ctl(w.epfd, EPOLL_CTL_DEL, fd, nullptr);
+        postTo(h->worker, [h]() {
+            delete h;
+        });
+    }
+
+    bool inWorker() const override
+    {
+        return curIo_ == this;
+    }
+
+    // 跑一个post给当前线程的任务；IO事件不在这里处理
+    bool runPending() override
+    {
+        if (curIo_ != this)
+        {
+            return false;
+        }
+        Worker &w = *workers_[curWorker_];
+        InlineTask task;
+        {
+            std::lock_guard<std::mutex> lock(w.mtx);
+            if (w.tasks.empty())
+            {
+                return false;
+            }
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+        }
+        runSafely(task);
+        return true;
+    }
+
+    // 当前线程是第几个IO线程，不是IO线程返回-1
+    int currentWorker() const
+    {
+        return curIo_ == this ? curWorker_ : -1;
+    }
+
+private:
+    struct Handler
+    {
+        int fd;
+        int worker;
+        std::atomic_bool dead;
+        IoCallback onRead;
+        IoCallback onWrite;
+    };
+
+    struct Worker
+    {
+        int epfd = -1;
+        int evfd = -1;
+        std::vector<int> cpus;
+        std::thread thread;
+        std::atomic_bool stop{false};
+        std::atomic_bool notified{false}; // 写过eventfd还没被读掉
+        std::mutex mtx;                   // 保护tasks和handlers
+        std::deque<InlineTask> tasks;
+        std::unordered_map<int, Handler *> handlers;
+
+        ~Worker()
+        {
+            for (auto &kv : handlers)
+            {
+                delete kv.second;
+            }
+            if (epfd >= 0)
+                close(epfd);
+            if (evfd >= 0)
+                close(evfd);
+        }
+    };
+
+    bool ctl(Worker &w, int op, Handler *h, bool writable)
+    {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP | (writable ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.ptr = h;
+        return epoll_ctl(w.epfd, op, h->fd, &ev) == 0;
+    }
+
+    // 从表里摘掉，之后只有摘的人碰它，删除推迟到它的线程上
+    Handler *take(int fd)
+    {
+        for (auto &w : workers_)
+        {
+            std::lock_guard<std::mutex> lock(w->mtx);
+            auto it = w->handlers.find(fd);
+            if (it != w->handlers.end())
+            {
+                Handler *h = it->second;
+                w->handlers.erase(it);
+                return h;
+            }
+        }
+        return nullptr;
+    }
+
+    void wake(Worker &w)
+    {
+        if (!w.notified.exchange(true, std::memory_order_acq_rel))
+        {
+            uint64_t one = 1;
+            ssize_t n = write(w.evfd, &one, sizeof(one));
+            (void)n;
+        }
+    }
+
+    static void runSafely(InlineTask &task)
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            TP_LOG_ERROR("io task throw exception");
+        }
+    }
+
+    static void dispatch(Handler *h, uint32_t events)
+    {
+        try
+        {
+            if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && h->onRead)
+            {
+                h->onRead(h->fd);
+            }
+            if ((events & EPOLLOUT) && h->onWrite && !h->dead.load(std::memory_order_relaxed))
+            {
+                h->onWrite(h->fd);
+            }
+        }
+        catch (...)
+        {
+            TP_LOG_ERROR("io callback throw exception, fd %d", h->fd);
+        }
+    }
+
+    // 先处理IO事件，再把这段时间post进来的任务一次拿完跑掉；队列里还有任务就不在epoll_wait里睡
+    void loop(int index)
+    {
+        Worker &w = *workers_[index];
+        curIo_ = this;
+        curWorker_ = index;
+        pinThread(w.cpus);
+
+        struct epoll_event events[IO_MAX_EVENTS];
+        std::deque<InlineTask> batch;
+        while (!w.stop.load(std::memory_order_relaxed))
+        {
+            int timeout;
+            {
+                std::lock_guard<std::mutex> lock(w.mtx);
+                timeout = w.tasks.empty() ? -1 : 0; // 自己post给自己的没写eventfd
+            }
+            int n = epoll_wait(w.epfd, events, IO_MAX_EVENTS, timeout);
+            for (int i = 0; i < n; ++i)
+            {
+                Handler *h = static_cast<Handler *>(events[i].data.ptr);
+                if (h == nullptr)
+                {
+                    uint64_t cnt;
+                    ssize_t r = read(w.evfd, &cnt, sizeof(cnt));
+                    (void)r;
+                    w.notified.store(false, std::memory_order_release); // 先清标记再取任务，清之后post的会再写一次
+                }
+                else if (!h->dead.load(std::memory_order_relaxed))
+                {
+                    dispatch(h, events[i].events);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(w.mtx);
+                batch.swap(w.tasks);
+            }
+            for (InlineTask &t : batch)
+            {
+                runSafely(t);
+            }
+            batch.clear();
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::vector<int>> cpuSets_;
+    std::atomic<uint32_t> next_; // 外部post轮到哪个线程
+    bool started_;
+
+    static inline thread_local IoExecutor *curIo_ = nullptr;
+    static inline thread_local int curWorker_ = -1;
+
+    // noncopyable
+    IoExecutor(const IoExecutor &) = delete;
+    void operator=(const IoExecutor &) = delete;
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// 日志级别，编译时-DTP_LOG_LEVEL=TP_LOG_LEVEL_xxx选，低于它的日志宏展开成空，参数都不求值
+#define TP_LOG_LEVEL_TRACE 0
+#define TP_LOG_LEVEL_DEBUG 1
+#define TP_LOG_LEVEL_INFO 2
+#define TP_LOG_LEVEL_WARN 3
+#define TP_LOG_LEVEL_ERROR 4
+#define TP_LOG_LEVEL_OFF 5
+
+#ifndef TP_LOG_LEVEL
+#define TP_LOG_LEVEL TP_LOG_LEVEL_INFO
+#endif
+
+const uint32_t LOG_RING_SIZE = 256; // 每个线程缓冲多少条，必须是2的幂
+const int LOG_LINE_SIZE = 240;      // 一条日志最长多少字节，长了截断
+const int LOG_FLUSH_MS = 20;        // 后台线程多久倒一次
+
+// 异步日志：每个线程一个单生产者环形缓冲，写日志只是把格式化好的一行放进自己的缓冲
+// 不加锁、不碰IO，所以在队列锁里打日志也不会把别的线程卡在IO上
+// 后台线程定期把所有缓冲倒进fd_；缓冲满了就丢，丢了几条下次一起报
+class AsyncLogger
+{
+public:
+    static AsyncLogger &instance()
+    {
+        static AsyncLogger *l = new AsyncLogger(); // 故意不释放，detach的线程可能比main活得久
+        return *l;
+    }
+
+    __attribute__((format(printf, 3, 4))) void log(int level, const char *fmt, ...)
+    {
+        Ring &r = ring();
+        uint32_t head = r.head.load(std::memory_order_relaxed);
+        if (head - r.tail.load(std::memory_order_acquire) == LOG_RING_SIZE)
+        {
+            r.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record &rec = r.records[head & (LOG_RING_SIZE - 1)];
+        rec.time = std::chrono::system_clock::now();
+        rec.level = level;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(rec.text, sizeof(rec.text), fmt, ap);
+        va_end(ap);
+        rec.len = n < 0 ? 0 : std::min(n, LOG_LINE_SIZE - 1);
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    // 把所有线程缓冲里的都写出去，进程退出时也会调一次
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        size_t used = 0;
+        for (size_t i = 0; i < rings_.size();)
+        {
+            Ring &r = *rings_[i];
+            uint32_t tail = r.tail.load(std::memory_order_relaxed);
+            uint32_t head = r.head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail)
+            {
+                if (sizeof(out_) - used < LINE_MAX_BYTES)
+                {
+                    writeOut(used);
+                    used = 0;
+                }
+                used += format(out_ + used, r.records[tail & (LOG_RING_SIZE - 1)], r.tid);
+            }
+            r.tail.store(tail, std::memory_order_release);
+
+            uint64_t dropped = r.dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0)
+            {
+                if (sizeof(out_) - used < LINE_MAX_BYTES)
+                {
+                    writeOut(used);
+                    used = 0;
+                }
+                used += snprintf(out_ + used, LINE_MAX_BYTES, "WARN  tid=%ld log ring full, dropped %lu lines\n", r.tid, (unsigned long)dropped);
+            }
+
+            // 线程已经退出并且倒空了，缓冲可以释放了
+            if (r.dead.load(std::memory_order_acquire) && r.head.load(std::memory_order_acquire) == tail)
+            {
+                rings_[i] = std::move(rings_.back());
+                rings_.pop_back();
+                continue;
+            }
+            ++i;
+        }
+        writeOut(used);
+    }
+
+    // 默认写stderr
+    void setFd(int fd)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        fd_ = fd;
+    }
+
+private:
+    AsyncLogger()
+        : fd_(STDERR_FILENO), flusherStarted_(false)
+    {
+    }
+
+    static const int LINE_MAX_BYTES = LOG_LINE_SIZE + 64; // 再加上时间、级别、tid
+
+    struct Record
+    {
+        std::chrono::system_clock::time_point time;
+        int level;
+        int len;
+        char text[LOG_LINE_SIZE];
+    };
+
+    struct Ring
+    {
+        std::atomic<uint32_t> head{0};             // 只有所属线程写
+        alignas(64) std::atomic<uint32_t> tail{0}; // 只有flush写
+        std::atomic<uint64_t> dropped{0};
+        std::atomic_bool dead{false};              // 所属线程已经退出
+        long tid = 0;
+        Record records[LOG_RING_SIZE];
+    };
+
+    // 线程退出时只做个标记，剩下的由flush倒完再释放
+    struct Holder
+    {
+        std::shared_ptr<Ring> r;
+        ~Holder()
+        {
+            if (r)
+            {
+                r->dead.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    // 第一次打日志时才分配缓冲，顺便把后台线程拉起来
+    Ring &ring()
+    {
+        thread_local Holder h;
+        if (!h.r)
+        {
+            h.r = std::make_shared<Ring>();
+            h.r->tid = syscall(SYS_gettid);
+            std::lock_guard<std::mutex> lock(mtx_);
+            rings_.push_back(h.r);
+            if (!flusherStarted_)
+            {
+                flusherStarted_ = true;
+                std::thread(&AsyncLogger::flushLoop, this).detach();
+            }
+        }
+        return *h.r;
+    }
+
+    void flushLoop()
+    {
+        for (;;)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_MS));
+            flush();
+        }
+    }
+
+    // 时间 级别 tid 正文，dst至少LINE_MAX_BYTES
+    static size_t format(char *dst, const Record &rec, long tid)
+    {
+        static const char *names[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR"};
+        time_t sec = std::chrono::system_clock::to_time_t(rec.time);
+        long usec = std::chrono::duration_cast<std::chrono::microseconds>(rec.time.time_since_epoch()).count() % 1000000;
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        size_t n = strftime(dst, LINE_MAX_BYTES, "%F %T", &tm);
+        n += snprintf(dst + n, LINE_MAX_BYTES - n, ".%06ld %s tid=%ld ", usec, names[rec.level], tid);
+        std::copy(rec.text, rec.text + rec.len, dst + n);
+        n += rec.len;
+        dst[n++] = '\n';
+        return n;
+    }
+
+    // 调用者持有mtx_
+    void writeOut(size_t len)
+    {
+        size_t done = 0;
+        while (done < len)
+        {
+            ssize_t n = ::write(fd_, out_ + done, len - done);
+            if (n <= 0)
+            {
+                return; // 写不出去就算了，日志不能把线程池拖住
+            }
+            done += n;
+        }
+    }
+
+    std::mutex mtx_; // 保护rings_、fd_、out_，只有注册新线程和flush会拿
+    std::vector<std::shared_ptr<Ring>> rings_;
+    int fd_;
+    bool flusherStarted_;
+    char out_[64 * 1024];
+
+    // noncopyable
+    AsyncLogger(const AsyncLogger &) = delete;
+    void operator=(const AsyncLogger &) = delete;
+};
+
+// main返回后把还没倒出去的日志写完
+struct LogFlushAtExit
+{
+    ~LogFlushAtExit()
+    {
+        AsyncLogger::instance().flush();
+    }
+};
+inline LogFlushAtExit logFlushAtExit;
+
+#if TP_LOG_LEVEL <= TP_LOG_LEVEL_TRACE
+#define TP_LOG_TRACE(...) AsyncLogger::instance().log(TP_LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define TP_LOG_TRACE(...) ((void)0)
+#endif
+
+#if TP_LOG_LEVEL <= TP_LOG_LEVEL_DEBUG
+#define TP_LOG_DEBUG(...) AsyncLogger::instance().log(TP_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define TP_LOG_DEBUG(...) ((void)0)
+#endif
+
+#if TP_LOG_LEVEL <= TP_LOG_LEVEL_INFO
+#define TP_LOG_INFO(...) AsyncLogger::instance().log(TP_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define TP_LOG_INFO(...) ((void)0)
+#endif
+
+#if TP_LOG_LEVEL <= TP_LOG_LEVEL_WARN
+#define TP_LOG_WARN(...) AsyncLogger::instance().log(TP_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define TP_LOG_WARN(...) ((void)0)
+#endif
+
+#if TP_LOG_LEVEL <= TP_LOG_LEVEL_ERROR
+#define TP_LOG_ERROR(...) AsyncLogger::instance().log(TP_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define TP_LOG_ERROR(...) ((void)0)
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Vyukov 有界多生产者多消费者队列
+// 每个格子带一个序号，生产者和消费者各自CAS抢位置，不用锁
+// 容量在构造时固定(向上取2的幂)，之后不再分配内存
+template <typename T>
+class MPMCQueue
+{
+public:
+    explicit MPMCQueue(size_t capacity)
+        : enqueuePos_(0), dequeuePos_(0)
+    {
+        size_t cap = 2;
+        while (cap < capacity)
+        {
+            cap <<= 1;
+        }
+        mask_ = cap - 1;
+        cells_.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; ++i)
+        {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    ~MPMCQueue() = default;
+
+    // 满了返回false，此时item不会被移走
+    bool tryPush(T &item)
+    {
+        Cell *cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // 这一格上一轮的数据还没被取走
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 空了返回false
+    bool tryPop(T &item)
+    {
+        Cell *cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        cell->data = T(); // 任务捕获的资源跟着任务走，别留在格子里
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    // 并发下只是个近似值
+    size_t size() const
+    {
+        size_t e = enqueuePos_.load(std::memory_order_relaxed);
+        size_t d = dequeuePos_.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    alignas(64) std::atomic<size_t> enqueuePos_;
+    alignas(64) std::atomic<size_t> dequeuePos_;
+    alignas(64) std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+
+    // noncopyable
+    MPMCQueue(const MPMCQueue &) = delete;
+    void operator=(const MPMCQueue &) = delete;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+// 工作线程绑核的方式
+enum class tpPlacement
+{
+    NONE_,    // 不绑核，所有线程共用一组队列(默认)
+    PINNED_,  // 按setCpuSets给的cpu集合绑，第i个槽位用第i%n组
+    SPREAD_,  // 轮流放到各个NUMA节点，每个线程绑一个cpu
+    COMPACT_, // 先把一个节点的cpu占满再用下一个节点
+};
+
+// NUMA拓扑：每个节点有哪些cpu
+// 默认从sysfs读，也可以用parse手写一个，单节点的机器上也能测多节点的逻辑
+struct NumaTopology
+{
+    std::vector<std::vector<int>> nodes;
+
+    // 读/sys/devices/system/node，只留当前进程能用的cpu；读不到就当一个节点
+    static NumaTopology detect()
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool haveMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        NumaTopology topo;
+        for (int node = 0;; ++node)
+        {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!in)
+            {
+                break;
+            }
+            std::string line;
+            std::getline(in, line);
+            std::vector<int> cpus;
+            for (int cpu : parseCpuList(line))
+            {
+                if (!haveMask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (!cpus.empty())
+            {
+                topo.nodes.push_back(cpus);
+            }
+        }
+
+        if (topo.nodes.empty())
+        {
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < CPU_SETSIZE && haveMask; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &allowed))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (cpus.empty())
+            {
+                cpus.push_back(0);
+            }
+            topo.nodes.push_back(cpus);
+        }
+        return topo;
+    }
+
+    // "0-3,8;4-7,9" 分号隔开节点，每个节点是内核cpulist的格式
+    static NumaTopology parse(const std::string &s)
+    {
+        NumaTopology topo;
+        size_t begin = 0;
+        while (begin <= s.size())
+        {
+            size_t end = s.find(';', begin);
+            if (end == std::string::npos)
+            {
+                end = s.size();
+            }
+            std::vector<int> cpus = parseCpuList(s.substr(begin, end - begin));
+            if (!cpus.empty())
+            {
+                topo.nodes.push_back(cpus);
+            }
+            begin = end + 1;
+        }
+        return topo;
+    }
+
+    // 内核的cpulist格式 "0-3,8,10-11"
+    static std::vector<int> parseCpuList(const std::string &s)
+    {
+        std::vector<int> cpus;
+        const char *p = s.c_str();
+        while (*p != '\0')
+        {
+            char *end;
+            long lo = std::strtol(p, &end, 10);
+            if (end == p)
+            {
+                ++p; // 空白、换行之类的跳过
+                continue;
+            }
+            long hi = lo;
+            p = end;
+            if (*p == '-')
+            {
+                hi = std::strtol(p + 1, &end, 10);
+                p = end;
+            }
+            for (long cpu = lo; cpu <= hi; ++cpu)
+            {
+                cpus.push_back((int)cpu);
+            }
+            if (*p == ',')
+            {
+                ++p;
+            }
+        }
+        return cpus;
+    }
+
+    // cpu所在的节点，不认识的cpu算0号节点
+    int nodeOf(int cpu) const
+    {
+        for (size_t n = 0; n < nodes.size(); ++n)
+        {
+            for (int c : nodes[n])
+            {
+                if (c == cpu)
+                {
+                    return (int)n;
+                }
+            }
+        }
+        return 0;
+    }
+};
+
+// 把当前线程绑到cpus上，cpus为空就不管
+inline bool pinThread(const std::vector<int> &cpus)
+{
+    if (cpus.empty())
+    {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+#include "future.h"
+
+// parallel_for/parallel_reduce/parallel_transform共用的状态
+// [0, n)不预先切死，参与者每次抢剩下的1/(2*参与者数)，块越抢越小，最小grain
+// 前面块大减少抢的次数，后面块小大家差不多同时干完
+// 调用者返回后还没开始跑的帮手只会看到没块可抢，不会碰body
+template <typename Body>
+struct ParallelState
+{
+    ParallelState(Body *b, size_t num, size_t g, int p)
+        : body(b), n(num), grain(g), participants(p), next(0), remaining(num), doneWord(0), failed(false)
+    {
+    }
+
+    bool grab(size_t &lo, size_t &hi)
+    {
+        size_t cur = next.load(std::memory_order_relaxed);
+        size_t size;
+        do
+        {
+            if (cur >= n)
+            {
+                return false;
+            }
+            size = std::min(n - cur, std::max(grain, (n - cur) / (2 * participants)));
+        } while (!next.compare_exchange_weak(cur, cur + size, std::memory_order_relaxed));
+        lo = cur;
+        hi = cur + size;
+        return true;
+    }
+
+    // slot区分参与者，reduce的部分结果按slot存，调用者是0
+    void work(int slot)
+    {
+        size_t lo, hi;
+        while (grab(lo, hi))
+        {
+            // 出过异常剩下的块就不跑了，但是还得记成做完
+            if (!failed.load(std::memory_order_relaxed))
+            {
+                try
+                {
+                    (*body)(lo, hi, slot);
+                }
+                catch (...)
+                {
+                    if (!failed.exchange(true))
+                    {
+                        ex = std::current_exception();
+                    }
+                }
+            }
+            if (remaining.fetch_sub(hi - lo, std::memory_order_acq_rel) == hi - lo)
+            {
+                doneWord.store(1, std::memory_order_release);
+                futexWakeAll(doneWord);
+            }
+        }
+    }
+
+    // 调用者自己抢不到块了，等别人手上的块做完
+    void wait()
+    {
+        while (doneWord.load(std::memory_order_acquire) == 0)
+        {
+            futexWait(doneWord, 0);
+        }
+        if (ex)
+        {
+            std::rethrow_exception(ex);
+        }
+    }
+
+    Body *body; // 指向调用者栈上的对象，只在还有块可抢时用
+    size_t n;
+    size_t grain;
+    int participants;
+    std::atomic<size_t> next;
+    std::atomic<size_t> remaining;
+    std::atomic<uint32_t> doneWord;
+    std::atomic_bool failed;
+    std::exception_ptr ex;
+};
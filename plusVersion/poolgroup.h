@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "threadpool.h"
+
+const uint64_t STRIDE_ONE = 1 << 20; // 权重为1的执行器每跑一个任务虚拟时间走这么多
+const int GROUP_EXECUTOR_CEILING = 64; // 一个组最多挂几个执行器
+
+// 一个逻辑执行器(一个服务/租户)的配置
+struct GroupExecutorOptions
+{
+    std::string name;
+    uint32_t weight = 1;               // 都有活干时按权重分线程，权重2的跑的任务数是权重1的两倍
+    uint32_t maxConcurrency = 0;       // 同时最多占几个线程，0不限；吵的服务占满了也给别人留线程
+    uint32_t taskCeiling = TASKNUM_CEILING; // 排队上限，满了直接拒
+};
+
+class PoolGroup;
+
+// 挂在PoolGroup上的逻辑执行器：自己的队列和锁、权重、并发上限，线程是整个组共用的
+// 用法和ThreadPool的提交差不多，队列满了不等，future里是SubmitRejected(REJECTED_)
+class GroupExecutor final : public Executor
+{
+public:
+    template <typename Func, typename... Args>
+    auto submitTask(Func &&func, Args &&...args) -> Future<decltype(func(args...))>
+    {
+        using retType = decltype(func(args...));
+        Promise<retType> promise;
+        promise.setExecutor(this);
+        Future<retType> result = promise.get_future();
+        InlineTask job([promise = std::move(promise), func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            promise.setWith([&]() -> retType {
+                return std::apply(func, args);
+            });
+        });
+        if (!push(job, false))
+        {
+            Promise<retType> rejected;
+            rejected.set_exception(std::make_exception_ptr(SubmitRejected(tpSubmitStatus::REJECTED_)));
+            return rejected.get_future();
+        }
+        return result;
+    }
+
+    // then的续体、strand的排空任务从这进来，不能丢，排队上限不管
+    void post(InlineTask fn) override
+    {
+        push(fn, true);
+    }
+
+    bool inWorker() const override;
+    bool runPending() override;
+
+    const std::string &name() const
+    {
+        return opt_.name;
+    }
+    // 计数都是原子变量，随时读，不拿锁
+    uint32_t queued() const
+    {
+        return queued_.load(std::memory_order_relaxed);
+    }
+    uint32_t running() const
+    {
+        return running_.load(std::memory_order_relaxed);
+    }
+    uint64_t completed() const
+    {
+        return completed_.load(std::memory_order_relaxed);
+    }
+    uint64_t rejected() const
+    {
+        return rejected_.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class PoolGroup;
+
+    GroupExecutor(PoolGroup &group, GroupExecutorOptions opt)
+        : group_(group), opt_(std::move(opt)), pass_(0), queued_(0), running_(0), completed_(0), rejected_(0)
+    {
+        if (opt_.weight == 0)
+        {
+            opt_.weight = 1;
+        }
+    }
+
+    bool push(InlineTask &job, bool force);
+
+    // 有排着的、没到并发上限；不拿锁看一眼，真取的时候在take里拿着mtx_再判断
+    bool runnable() const
+    {
+        return queued_.load() > 0 && (opt_.maxConcurrency == 0 || running_.load() < opt_.maxConcurrency);
+    }
+
+    // 取出队首的任务记上账；被别的跑手抢先取走了、或者到了并发上限返回false
+    bool take(InlineTask &task);
+
+    PoolGroup &group_;
+    GroupExecutorOptions opt_;
+    std::mutex mtx_;               // 只保护tasks_，各执行器各用各的
+    std::queue<InlineTask> tasks_;
+    std::atomic<uint64_t> pass_;   // 虚拟时间，跑一个任务加STRIDE_ONE/weight，谁最小谁先跑；只在mtx_里改
+    std::atomic<uint32_t> queued_; // tasks_的大小，挑执行器时不拿锁看
+    std::atomic<uint32_t> running_; // 正在跑的任务数
+    std::atomic<uint64_t> completed_;
+    std::atomic<uint64_t> rejected_;
+
+    // noncopyable
+    GroupExecutor(const GroupExecutor &) = delete;
+    void operator=(const GroupExecutor &) = delete;
+};
+
+// 一组共用的工作线程，上面挂多个逻辑执行器，按权重公平调度(stride scheduling)
+// 每个服务一个ThreadPool时64核的机器上要开几百个线程，挂在一个组上只开一份
+// 线程就是一个ThreadPool的工作线程，停车、统计、绑核、定时器都是它的，start前通过pool()设置
+// 组里没有全局锁：池子里最多放线程数个"跑手"任务，跑手按虚拟时间挑一个执行器、取它队首的任务跑掉，
+// 还有能跑的就把自己交回池子排队(池子里别的任务也插得进来)，没有就退，下次提交再派
+// 每次挑可以跑的执行器里虚拟时间最小的；执行器从闲到忙时虚拟时间追到当前，闲着时不攒额度
+// 执行器不多(几个到几十个服务)，挑的时候直接扫一遍原子变量
+// 析构和ThreadPool一样，排着的任务跑完才停(没start过的就没人跑了，future拿到broken_promise)
+class PoolGroup
+{
+public:
+    PoolGroup() : executorsNum_(0), runners_(0), runnersCeiling_(0), vtime_(0), started_(false)
+    {
+    }
+
+    // pool_最后声明最先析构：它等跑手把执行器里排着的跑完，那时执行器和计数都还在
+    ~PoolGroup() = default;
+
+    // start前后都能加，最多GROUP_EXECUTOR_CEILING个，返回的引用和组活得一样久
+    GroupExecutor &createExecutor(GroupExecutorOptions opt)
+    {
+        std::lock_guard<std::mutex> lock(createMtx_);
+        int n = executorsNum_.load(std::memory_order_relaxed);
+        if (n >= GROUP_EXECUTOR_CEILING)
+        {
+            throw std::length_error("PoolGroup: too many executors");
+        }
+        executors_[n].reset(new GroupExecutor(*this, std::move(opt)));
+        executorsNum_.store(n + 1, std::memory_order_release); // 跑手看到个数就看得到执行器
+        return *executors_[n];
+    }
+
+    // 底下的线程池，绑核、调度方式这些设置在start前调
+    ThreadPool &pool()
+    {
+        return pool_;
+    }
+
+    void start(int threadsNum = std::thread::hardware_concurrency())
+    {
+        if (started_)
+            return;
+        threadsNum = std::max(threadsNum, 1);
+        runnersCeiling_ = threadsNum;
+        pool_.start(threadsNum);
+        started_ = true;
+        // start前提交的还没有跑手，按能跑的任务数补，最多到线程数
+        uint64_t want = 0;
+        for (int i = 0; i < executorsNum_.load(std::memory_order_acquire); ++i)
+        {
+            GroupExecutor &e = *executors_[i];
+            uint64_t spare = e.queued_.load();
+            if (e.opt_.maxConcurrency != 0)
+            {
+                spare = std::min<uint64_t>(spare, e.opt_.maxConcurrency);
+            }
+            want += spare;
+        }
+        for (; want > 0 && claimRunner(); --want)
+        {
+            spawnRunner();
+        }
+    }
+
+    int threads() const
+    {
+        return runnersCeiling_;
+    }
+
+private:
+    friend class GroupExecutor;
+
+    GroupExecutor *pick() const
+    {
+        GroupExecutor *best = nullptr;
+        uint64_t bestPass = 0;
+        int n = executorsNum_.load(std::memory_order_acquire);
+        for (int i = 0; i < n; ++i)
+        {
+            GroupExecutor *e = executors_[i].get();
+            if (!e->runnable())
+            {
+                continue;
+            }
+            uint64_t pass = e->pass_.load(std::memory_order_relaxed);
+            if (best == nullptr || pass < bestPass)
+            {
+                best = e;
+                bestPass = pass;
+            }
+        }
+        return best;
+    }
+
+    bool anyRunnable() const
+    {
+        int n = executorsNum_.load(std::memory_order_acquire);
+        for (int i = 0; i < n; ++i)
+        {
+            if (executors_[i]->runnable())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 执行器有活可以跑了：跑手没到线程数就再派一个；start之前不派，start时统一补
+    void wake(GroupExecutor &e)
+    {
+        if (started_ && e.runnable() && claimRunner())
+        {
+            spawnRunner();
+        }
+    }
+
+    bool claimRunner()
+    {
+        int n = runners_.load();
+        while (n < runnersCeiling_)
+        {
+            if (runners_.compare_exchange_weak(n, n + 1))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void spawnRunner()
+    {
+        pool_.post([this]() { runner(); });
+    }
+
+    void runner()
+    {
+        runOne();
+        while (true)
+        {
+            if (anyRunnable())
+            {
+                spawnRunner();
+                return;
+            }
+            runners_--;
+            // 和push里先放任务、再看runners_配对：减完再看一眼，刚放进来的不会没人跑
+            if (!anyRunnable() || !claimRunner())
+            {
+                return;
+            }
+        }
+    }
+
+    // 挑虚拟时间最小的能跑的执行器，取一个任务跑掉；被别的跑手抢先了就重挑
+    bool runOne()
+    {
+        GroupExecutor *e;
+        InlineTask task;
+        do
+        {
+            e = pick();
+            if (e == nullptr)
+            {
+                return false;
+            }
+        } while (!e->take(task));
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            TP_LOG_ERROR("group task throw exception, executor %s", e->opt_.name.c_str());
+        }
+        // 这个执行器之前被并发上限卡住、还有积压的话，跑手回头看一眼就会再派，不用叫别人
+        e->running_--;
+        e->completed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::mutex createMtx_; // 只在加执行器时用
+    std::unique_ptr<GroupExecutor> executors_[GROUP_EXECUTOR_CEILING];
+    std::atomic_int executorsNum_;
+    std::atomic_int runners_;      // 池子里排着的和正在跑的跑手数
+    int runnersCeiling_;           // 跑手最多几个，等于线程数，池子的队列不会被它们塞满
+    std::atomic<uint64_t> vtime_;  // 最近一次派出去的任务的虚拟时间
+    std::atomic_bool started_;
+    ThreadPool pool_;
+
+    // noncopyable
+    PoolGroup(const PoolGroup &) = delete;
+    void operator=(const PoolGroup &) = delete;
+};
+
+//---------------------------------------------
+
+inline bool GroupExecutor::push(InlineTask &job, bool force)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!force && tasks_.size() >= opt_.taskCeiling)
+        {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (tasks_.empty() && running_.load() == 0)
+        {
+            // 闲了一阵子回来，不能拿攒下的额度把别人挤掉
+            pass_.store(std::max(pass_.load(std::memory_order_relaxed), group_.vtime_.load(std::memory_order_relaxed)),
+                        std::memory_order_relaxed);
+        }
+        tasks_.push(std::move(job));
+        queued_++;
+    }
+    group_.wake(*this);
+    return true;
+}
+
+inline bool GroupExecutor::take(InlineTask &task)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (tasks_.empty() || (opt_.maxConcurrency != 0 && running_.load() >= opt_.maxConcurrency))
+    {
+        return false;
+    }
+    task = std::move(tasks_.front());
+    tasks_.pop();
+    queued_--;
+    running_++;
+    uint64_t pass = pass_.load(std::memory_order_relaxed);
+    group_.vtime_.store(pass, std::memory_order_relaxed);
+    pass_.store(pass + STRIDE_ONE / opt_.weight, std::memory_order_relaxed);
+    return true;
+}
+
+inline bool GroupExecutor::inWorker() const
+{
+    return group_.pool_.inWorker();
+}
+
+// 在池子线程上等结果时先跑池子里排着的(多半是跑手)；跑手都卡在等结果的任务里时池子是空的，
+// 直接按权重挑一个执行器的任务跑，不然一个线程的组里嵌套等待就死锁了
+inline bool GroupExecutor::runPending()
+{
+    return group_.pool_.runPending() || (inWorker() && group_.runOne());
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "task.h"
+
+// 线程池运行时统计，编译时-DTP_STATS=0整个关掉，任务也不再带时间戳
+#ifndef TP_STATS
+#define TP_STATS 1
+#endif
+
+const int HIST_SUB_BITS = 3;  // 每个2的幂区间再分8格，误差在12.5%以内
+const int HIST_MAX_BITS = 40; // 最大2^40ns(约18分钟)，再大的都算在最后一格
+const int HIST_BUCKETS = (HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS;
+
+inline uint64_t statsNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// HDR那种对数-线性分桶：小于8的一个值一格，往上每个2的幂区间分8格
+inline int histBucket(uint64_t v)
+{
+    if (v < (uint64_t(1) << HIST_SUB_BITS))
+    {
+        return (int)v;
+    }
+    if (v >= (uint64_t(1) << HIST_MAX_BITS))
+    {
+        return HIST_BUCKETS - 1;
+    }
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// 第idx格能装的最大值
+inline uint64_t histUpper(int idx)
+{
+    int group = idx >> HIST_SUB_BITS;
+    uint64_t sub = idx & ((1 << HIST_SUB_BITS) - 1);
+    if (group == 0)
+    {
+        return sub;
+    }
+    return (((uint64_t(1) << HIST_SUB_BITS) + sub + 1) << (group - 1)) - 1;
+}
+
+// 只有一个线程写的计数器，写的时候不用带lock前缀的原子加，别的线程随时可以读
+class StatCounter
+{
+public:
+    void add(uint64_t n = 1)
+    {
+        v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t get() const
+    {
+        return v_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> v_{0};
+};
+
+// 直方图的快照，可以把多个线程的合起来，值的单位由记录的人定(线程池里是ns)
+class Histogram
+{
+public:
+    Histogram()
+        : counts_(HIST_BUCKETS, 0), total_(0), sum_(0)
+    {
+    }
+
+    uint64_t count() const
+    {
+        return total_;
+    }
+
+    double mean() const
+    {
+        return total_ == 0 ? 0 : double(sum_) / total_;
+    }
+
+    // q在[0, 1]，比如0.99；返回所在格子的上界，只会偏大不会偏小
+    uint64_t percentile(double q) const
+    {
+        if (total_ == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q * (total_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < HIST_BUCKETS; ++i)
+        {
+            seen += counts_[i];
+            if (seen >= rank)
+            {
+                return histUpper(i);
+            }
+        }
+        return histUpper(HIST_BUCKETS - 1);
+    }
+
+    uint64_t max() const
+    {
+        return percentile(1.0);
+    }
+
+    void add(int bucket, uint64_t n)
+    {
+        counts_[bucket] += n;
+        total_ += n;
+    }
+    void addSum(uint64_t sum)
+    {
+        sum_ += sum;
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t sum_;
+};
+
+// 单线程写的直方图
+class HistogramCell
+{
+public:
+    void record(uint64_t v)
+    {
+        counts_[histBucket(v)].add();
+        sum_.add(v);
+    }
+
+    // 合进快照里，读的时候写的线程还在写，各格之间不保证是同一时刻的
+    void mergeInto(Histogram &h) const
+    {
+        for (int i = 0; i < HIST_BUCKETS; ++i)
+        {
+            uint64_t n = counts_[i].get();
+            if (n > 0)
+            {
+                h.add(i, n);
+            }
+        }
+        h.addSum(sum_.get());
+    }
+
+private:
+    StatCounter counts_[HIST_BUCKETS];
+    StatCounter sum_;
+};
+
+// 每个线程槽位一份，只有占着这个槽位的线程写
+struct alignas(64) WorkerStatsCell
+{
+    StatCounter busyNs;  // 跑任务花的时间
+    StatCounter steals;  // 从别的线程本地队列偷到几个
+    HistogramCell queueWait; // 从提交到开始跑
+    HistogramCell execTime;  // 任务本身跑了多久
+};
+
+struct WorkerStats
+{
+    int slot;
+    uint64_t tasks;
+    uint64_t busyNs;
+    uint64_t steals;
+};
+
+// ThreadPool::stats()返回的快照
+struct PoolStats
+{
+    int threads = 0;            // 现在的线程数，cached模式下含备用的
+    int activeThreads = 0;      // 上岗接任务的线程数
+    unsigned idleThreads = 0;   // 没在跑任务的线程数
+    unsigned queued = 0;        // 还没开始跑的任务数
+    uint64_t rejected = 0;      // 队列满被拒的提交
+    uint64_t dropped = 0;       // DROP_OLDEST_丢掉的任务
+    uint64_t callerRuns = 0;    // CALLER_RUNS_在提交线程上跑的任务
+    uint64_t expired = 0;       // 排队过了deadline没跑的任务
+    uint64_t cancelled = 0;     // 排队时被取消没跑的任务
+    uint64_t threadsCreated = 0;   // cached模式控制线程创建的线程
+    uint64_t threadsDestroyed = 0; // cached模式退掉的线程
+    std::vector<WorkerStats> workers; // 每个槽位一项，TP_STATS=0时为空
+    Histogram queueWait;        // ns，所有线程合起来
+    Histogram execTime;         // ns
+};
+
+//---------------------------------------------
+
+// 带提交时间的任务，算排队等了多久；其他和InlineTask一样
+class StampedTask
+{
+public:
+    StampedTask() noexcept
+        : stamp_(0)
+    {
+    }
+
+    template <typename F, typename = typename std::enable_if<
+                              !std::is_same<typename std::decay<F>::type, StampedTask>::value>::type>
+    StampedTask(F &&f)
+        : fn_(std::forward<F>(f)), stamp_(statsNow())
+    {
+    }
+
+    StampedTask(StampedTask &&) noexcept = default;
+    StampedTask &operator=(StampedTask &&) noexcept = default;
+
+    void operator()()
+    {
+        fn_();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return (bool)fn_;
+    }
+
+    uint64_t stamp() const
+    {
+        return stamp_;
+    }
+
+private:
+    InlineTask fn_;
+    uint64_t stamp_; // statsNow()
+};
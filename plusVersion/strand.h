@@ -0,0 +1,259 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "future.h"
+#include "log.h"
+#include "task.h"
+
+const int STRAND_SHARD_BITS = 6; // 按key分的strand表分2^6段，每段一把锁
+
+// strand里排队的任务，单链表串起来，节点从NodePool拿
+struct StrandNode
+{
+    InlineTask fn;
+    StrandNode *next_ = nullptr;
+};
+
+// 一串FIFO任务，Strand和StrandTable共用；自己不加锁，由外面的锁保护
+struct StrandList
+{
+    StrandNode *head = nullptr;
+    StrandNode *tail = nullptr;
+
+    void push(InlineTask fn)
+    {
+        StrandNode *n = NodePool<StrandNode>::get();
+        n->fn = std::move(fn);
+        n->next_ = nullptr;
+        if (tail == nullptr)
+        {
+            head = n;
+        }
+        else
+        {
+            tail->next_ = n;
+        }
+        tail = n;
+    }
+
+    // 整串摘下来，锁外跑
+    StrandNode *take()
+    {
+        StrandNode *n = head;
+        head = tail = nullptr;
+        return n;
+    }
+
+    // 按顺序跑完摘下来的一串，节点还回NodePool；任务抛的异常只记日志，不影响后面的
+    static void run(StrandNode *n)
+    {
+        while (n != nullptr)
+        {
+            StrandNode *next = n->next_;
+            try
+            {
+                n->fn();
+            }
+            catch (...)
+            {
+                TP_LOG_ERROR("strand task throw exception");
+            }
+            n->fn = InlineTask();
+            NodePool<StrandNode>::put(n);
+            n = next;
+        }
+    }
+
+    // 没跑的直接扔掉(executor停了)
+    static void discard(StrandNode *n)
+    {
+        while (n != nullptr)
+        {
+            StrandNode *next = n->next_;
+            n->fn = InlineTask();
+            NodePool<StrandNode>::put(n);
+            n = next;
+        }
+    }
+};
+
+// 串行executor：post进来的任务按FIFO一个一个跑，底下借ex的线程
+// 有任务时往ex上交一个排空任务，排空任务一次把攒下的都跑完，中途再来的下一轮再跑(先让别的任务跑一下)
+// 闲着时只是一把锁两个指针，不占线程；等的时候也不占线程，可以一个连接一个
+// 析构前要保证没有任务还在排队或在跑
+class Strand final : public Executor
+{
+public:
+    explicit Strand(Executor &ex) : ex_(ex), running_(false)
+    {
+    }
+
+    ~Strand()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        StrandList::discard(list_.take());
+    }
+
+    void post(InlineTask fn) override
+    {
+        bool schedule;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            list_.push(std::move(fn));
+            schedule = !running_;
+            running_ = true;
+        }
+        if (schedule)
+        {
+            ex_.post([this]() {
+                drain();
+            });
+        }
+    }
+
+    // 在strand上跑func，返回的future上then的续体也回到这个strand
+    template <typename Func, typename... Args>
+    auto submitTask(Func &&func, Args &&...args) -> Future<decltype(func(args...))>
+    {
+        using retType = decltype(func(args...));
+        Promise<retType> promise;
+        promise.setExecutor(this);
+        Future<retType> result = promise.get_future();
+        post([promise = std::move(promise), func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            promise.setWith([&]() -> retType {
+                return std::apply(func, args);
+            });
+        });
+        return result;
+    }
+
+    // strand任务里等别的future时，帮底下的executor跑别的任务；这个strand的排空任务不在队列里，顺序不会乱
+    bool inWorker() const override
+    {
+        return ex_.inWorker();
+    }
+    bool runPending() override
+    {
+        return ex_.runPending();
+    }
+
+private:
+    void drain()
+    {
+        StrandNode *batch;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            batch = list_.take();
+        }
+        StrandList::run(batch);
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (list_.head == nullptr)
+            {
+                running_ = false;
+                return;
+            }
+        }
+        ex_.post([this]() {
+            drain();
+        });
+    }
+
+    Executor &ex_;
+    std::mutex mtx_;
+    StrandList list_;
+    bool running_; // 有排空任务交出去了还没结束
+
+    // noncopyable
+    Strand(const Strand &) = delete;
+    void operator=(const Strand &) = delete;
+};
+
+//---------------------------------------------
+
+// 按key(比如连接id)串行：同一个key的任务FIFO一个一个跑，不同key并行
+// 只有有任务的key在表里，跑空了就删掉，几十万个连接闲着也不占东西
+class StrandTable
+{
+public:
+    explicit StrandTable(Executor &ex) : ex_(ex)
+    {
+    }
+
+    ~StrandTable()
+    {
+        for (Shard &s : shards_)
+        {
+            for (auto &kv : s.keys)
+            {
+                StrandList::discard(kv.second.take());
+            }
+        }
+    }
+
+    void post(uint64_t key, InlineTask fn)
+    {
+        Shard &s = shard(key);
+        bool schedule;
+        {
+            std::lock_guard<std::mutex> lock(s.mtx);
+            auto res = s.keys.try_emplace(key);
+            res.first->second.push(std::move(fn));
+            schedule = res.second; // 新建的说明没有排空任务在跑
+        }
+        if (schedule)
+        {
+            ex_.post([this, key]() {
+                drain(key);
+            });
+        }
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<uint64_t, StrandList> keys; // 在表里 = 有排空任务在跑
+    };
+
+    Shard &shard(uint64_t key)
+    {
+        return shards_[(key * 0x9E3779B97F4A7C15ull) >> (64 - STRAND_SHARD_BITS)]; // 乘法散一下，连续的id分到不同段
+    }
+
+    void drain(uint64_t key)
+    {
+        Shard &s = shard(key);
+        StrandNode *batch;
+        {
+            std::lock_guard<std::mutex> lock(s.mtx);
+            batch = s.keys[key].take();
+        }
+        StrandList::run(batch);
+        {
+            std::lock_guard<std::mutex> lock(s.mtx);
+            auto it = s.keys.find(key);
+            if (it->second.head == nullptr)
+            {
+                s.keys.erase(it);
+                return;
+            }
+        }
+        ex_.post([this, key]() {
+            drain(key);
+        });
+    }
+
+    Executor &ex_;
+    Shard shards_[1 << STRAND_SHARD_BITS];
+
+    // noncopyable
+    StrandTable(const StrandTable &) = delete;
+    void operator=(const StrandTable &) = delete;
+};
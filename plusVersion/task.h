@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 只能移动的任务包装，代替std::function<void()>
+// 小于TASK_INLINE_SIZE的可调用对象直接放在对象内部，提交任务不用再new
+// std::function要求可拷贝，装不下packaged_task这种只能移动的东西，只好再套一层shared_ptr
+class InlineTask
+{
+public:
+    static constexpr size_t TASK_INLINE_SIZE = 64;
+
+    InlineTask() noexcept
+        : ops_(nullptr)
+    {
+    }
+
+    template <typename F, typename = typename std::enable_if<
+                              !std::is_same<typename std::decay<F>::type, InlineTask>::value>::type>
+    InlineTask(F &&f)
+    {
+        using Fn = typename std::decay<F>::type;
+        if constexpr (fitsInline<Fn>())
+        {
+            new (buf_) Fn(std::forward<F>(f));
+            ops_ = &inlineOps<Fn>;
+        }
+        else
+        {
+            // 装不下的只好放堆上，buf_里只存一个指针
+            *reinterpret_cast<Fn **>(buf_) = new Fn(std::forward<F>(f));
+            ops_ = &heapOps<Fn>;
+        }
+    }
+
+    InlineTask(InlineTask &&other) noexcept
+        : ops_(other.ops_)
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->move(buf_, other.buf_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    InlineTask &operator=(InlineTask &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            ops_ = other.ops_;
+            if (ops_ != nullptr)
+            {
+                ops_->move(buf_, other.buf_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    ~InlineTask()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        ops_->call(buf_);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+private:
+    // 手写的虚表，每种可调用对象一份
+    struct Ops
+    {
+        void (*call)(void *self);
+        void (*move)(void *dst, void *src); // 移到dst，并析构src
+        void (*destroy)(void *self);
+    };
+
+    template <typename Fn>
+    static constexpr bool fitsInline()
+    {
+        // 移动要求noexcept，不然队列里搬来搬去抛异常就没法收拾了
+        return sizeof(Fn) <= TASK_INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <typename Fn>
+    static void inlineCall(void *self)
+    {
+        (*static_cast<Fn *>(self))();
+    }
+    template <typename Fn>
+    static void inlineMove(void *dst, void *src)
+    {
+        new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+        static_cast<Fn *>(src)->~Fn();
+    }
+    template <typename Fn>
+    static void inlineDestroy(void *self)
+    {
+        static_cast<Fn *>(self)->~Fn();
+    }
+
+    template <typename Fn>
+    static void heapCall(void *self)
+    {
+        (**static_cast<Fn **>(self))();
+    }
+    static void heapMove(void *dst, void *src)
+    {
+        *static_cast<void **>(dst) = *static_cast<void **>(src);
+    }
+    template <typename Fn>
+    static void heapDestroy(void *self)
+    {
+        delete *static_cast<Fn **>(self);
+    }
+
+    template <typename Fn>
+    static constexpr Ops inlineOps = {&inlineCall<Fn>, &inlineMove<Fn>, &inlineDestroy<Fn>};
+    template <typename Fn>
+    static constexpr Ops heapOps = {&heapCall<Fn>, &heapMove, &heapDestroy<Fn>};
+
+    void reset()
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy(buf_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char buf_[TASK_INLINE_SIZE];
+    const Ops *ops_;
+
+    // noncopyable
+    InlineTask(const InlineTask &) = delete;
+    void operator=(const InlineTask &) = delete;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "future.h"
+
+// 任务图：add加节点，precede连边，run时入度为0的先交给executor
+// 每个节点跑完给后继减入度，减到0的马上交出去，等依赖的时候不占线程
+// 整张图跑完时返回的future就绪；有节点抛异常，后面的节点照样放行但不再跑，最后future带着第一个异常
+// 同一张图可以run多次，run返回的future就绪之前图不能改、不能析构
+class TaskGraph
+{
+public:
+    using NodeId = size_t;
+
+    NodeId add(std::function<void()> fn)
+    {
+        nodes_.push_back(Node{std::move(fn), {}, 0});
+        return nodes_.size() - 1;
+    }
+
+    // after等before跑完才跑
+    void precede(NodeId before, NodeId after)
+    {
+        nodes_[before].next.push_back(after);
+        nodes_[after].deps++;
+    }
+
+    size_t size() const
+    {
+        return nodes_.size();
+    }
+
+    Future<void> run(Executor &ex)
+    {
+        auto st = std::make_shared<RunState>(this, &ex);
+        st->promise.setExecutor(&ex);
+        Future<void> result = st->promise.get_future();
+        if (hasCycle())
+        {
+            st->promise.set_exception(std::make_exception_ptr(std::invalid_argument("task graph has a cycle")));
+            return result;
+        }
+        if (nodes_.empty())
+        {
+            st->promise.set_value();
+            return result;
+        }
+
+        for (NodeId i = 0; i < nodes_.size(); ++i)
+        {
+            if (nodes_[i].deps == 0)
+            {
+                release(st, i);
+            }
+        }
+        return result;
+    }
+
+private:
+    struct Node
+    {
+        std::function<void()> fn;
+        std::vector<NodeId> next; // 后继
+        int deps;                 // 入度
+    };
+
+    // 一次run的状态，所有放出去的节点任务共享
+    struct RunState
+    {
+        RunState(TaskGraph *g, Executor *e)
+            : graph(g), ex(e), left(g->nodes_.size()), deps(g->nodes_.size()), failed(false)
+        {
+            for (size_t i = 0; i < deps.size(); ++i)
+            {
+                deps[i] = g->nodes_[i].deps;
+            }
+        }
+        TaskGraph *graph;
+        Executor *ex;
+        std::atomic<size_t> left;             // 还没跑完的节点数
+        std::vector<std::atomic_int> deps;    // 每个节点还差几个前驱
+        std::atomic_bool failed;
+        std::exception_ptr error; // 第一个异常，抢到failed的写
+        Promise<void> promise;
+    };
+
+    static void release(const std::shared_ptr<RunState> &st, NodeId id)
+    {
+        st->ex->post([st, id]() {
+            runNode(st, id);
+        });
+    }
+
+    static void runNode(const std::shared_ptr<RunState> &st, NodeId id)
+    {
+        Node &node = st->graph->nodes_[id];
+        if (!st->failed)
+        {
+            try
+            {
+                node.fn();
+            }
+            catch (...)
+            {
+                if (!st->failed.exchange(true))
+                {
+                    st->error = std::current_exception(); // 等都放行完了再交出去，那之前图还在用
+                }
+            }
+        }
+        for (NodeId next : node.next)
+        {
+            if (st->deps[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                release(st, next);
+            }
+        }
+        if (st->left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            if (st->error)
+            {
+                st->promise.set_exception(st->error);
+            }
+            else
+            {
+                st->promise.set_value();
+            }
+        }
+    }
+
+    // Kahn算法拓扑排序，排不完就是有环
+    bool hasCycle() const
+    {
+        std::vector<int> deps(nodes_.size());
+        std::vector<NodeId> ready;
+        for (NodeId i = 0; i < nodes_.size(); ++i)
+        {
+            deps[i] = nodes_[i].deps;
+            if (deps[i] == 0)
+            {
+                ready.push_back(i);
+            }
+        }
+        size_t seen = 0;
+        while (!ready.empty())
+        {
+            NodeId id = ready.back();
+            ready.pop_back();
+            seen++;
+            for (NodeId next : nodes_[id].next)
+            {
+                if (--deps[next] == 0)
+                {
+                    ready.push_back(next);
+                }
+            }
+        }
+        return seen != nodes_.size();
+    }
+
+    std::vector<Node> nodes_;
+};
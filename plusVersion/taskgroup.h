@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <utility>
+
+#include "future.h"
+#include "task.h"
+
+// 一组没有返回值的任务，run往executor上交，wait等这一组都跑完
+// 在executor自己的工作线程上wait不会睡着，帮着跑排队的任务(包括这一组的)，嵌套分治不用额外的线程
+// 有任务抛异常，wait重新抛第一个；析构前要wait过
+class TaskGroup
+{
+public:
+    explicit TaskGroup(Executor &ex) : ex_(ex), st_(std::make_shared<State>())
+    {
+    }
+
+    ~TaskGroup()
+    {
+        // 忘了wait也得等，任务里的fn可能引用着调用者栈上的东西
+        waitDone();
+    }
+
+    template <typename F>
+    void run(F &&fn)
+    {
+        st_->pending.fetch_add(1, std::memory_order_relaxed);
+        ex_.post([st = st_, fn = std::forward<F>(fn)]() mutable {
+            if (!st->failed.load(std::memory_order_relaxed))
+            {
+                try
+                {
+                    fn();
+                }
+                catch (...)
+                {
+                    if (!st->failed.exchange(true))
+                    {
+                        st->error = std::current_exception();
+                    }
+                }
+            }
+            // 减到0之后等的人随时可能返回、把TaskGroup析构掉，这里只碰st
+            if (st->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                futexWakeAll(st->pending);
+            }
+        });
+    }
+
+    void wait()
+    {
+        waitDone();
+        if (st_->error)
+        {
+            std::exception_ptr ex = std::move(st_->error);
+            st_->error = nullptr;
+            st_->failed = false;
+            std::rethrow_exception(ex);
+        }
+    }
+
+private:
+    void waitDone()
+    {
+        std::atomic<uint32_t> &pending = st_->pending;
+        auto done = [&pending]() { return pending.load(std::memory_order_acquire) == 0; };
+        if (helpWhileWaiting(&ex_, done, [&pending](std::chrono::nanoseconds timeout) {
+                uint32_t p = pending.load(std::memory_order_acquire);
+                if (p != 0)
+                {
+                    futexWaitFor(pending, p, timeout);
+                }
+            }))
+        {
+            return;
+        }
+        uint32_t p;
+        while ((p = pending.load(std::memory_order_acquire)) != 0)
+        {
+            futexWait(pending, p);
+        }
+    }
+
+    // 任务共享的计数和异常，每个任务拿一份引用，最后一个任务唤醒时TaskGroup可能已经没了
+    struct State
+    {
+        std::atomic<uint32_t> pending{0}; // 还没跑完的任务数，归零时futex唤醒
+        std::atomic_bool failed{false};   // 出过异常后面的任务就不跑了
+        std::exception_ptr error;         // 第一个异常，抢到failed的写
+    };
+
+    Executor &ex_;
+    std::shared_ptr<State> st_;
+
+    // noncopyable
+    TaskGroup(const TaskGroup &) = delete;
+    void operator=(const TaskGroup &) = delete;
+};
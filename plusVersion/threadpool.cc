@@ -1,6 +1,5 @@
 
 #include <functional>
-#include <future>
 #include <iostream>
 #include <thread>
 
@@ -14,6 +13,323 @@ int sum(int a,int b)
     return a+b;
 }
 
+// 下面几段是行为检查，不对的打出来，main最后返回非0
+static int bad = 0;
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        bad++;
+        std::cout<<"FAILED: "<<what<<std::endl;
+    }
+}
+
+// 池子里的线程堵住用这个，别用future::wait：工作线程等future时会去帮着跑排队的任务
+static void holdUntil(const atomic_bool &open)
+{
+    while (!open)
+    {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+// 定时任务：一次性的到点跑一次，取消了的不跑，周期的取消后不再跑
+// 队列满的时候到期的定时任务就地跑，不堵住触发它的工作线程，也不丢
+void checkTimers()
+{
+    ThreadPool pool;
+    pool.start(2);
+    atomic_int once(0), at(0), never(0), ticks(0);
+    pool.submitAfter(chrono::milliseconds(10), [&](){ once++; });
+    pool.submitAt(chrono::system_clock::now() + chrono::milliseconds(10), [&](){ at++; });
+    TimerHandle dead = pool.submitAfter(chrono::milliseconds(10), [&](){ never++; });
+    dead.cancel();
+    TimerHandle every = pool.submitEvery(chrono::milliseconds(5), [&](){ ticks++; });
+    this_thread::sleep_for(chrono::milliseconds(100));
+    every.cancel();
+    this_thread::sleep_for(chrono::milliseconds(20)); // 取消时正在跑的那一次拦不住，等它跑完
+    int stopped = ticks;
+    this_thread::sleep_for(chrono::milliseconds(50));
+    check(once == 1 && at == 1, "one-shot timers fire once");
+    check(never == 0, "cancelled one-shot never runs");
+    check(stopped >= 2 && ticks == stopped, "periodic timer stops after cancel");
+
+    // 一个线程堵住，另一个在任务里把队列塞满、拖过定时任务的到期时间，回头触发时队列还是满的
+    ThreadPool full;
+    full.setTaskCeiling(2);
+    full.start(2);
+    atomic_bool open(false), holding(false);
+    atomic_int fired(0);
+    full.submitTask([&](){ holding = true; holdUntil(open); });
+    while (!holding)
+    {
+        this_thread::yield();
+    }
+    full.submitTask([&](){
+        full.submitAfter(chrono::milliseconds(5), [&](){ fired++; });
+        full.submitTask([](){});
+        full.submitTask([](){});
+        this_thread::sleep_for(chrono::milliseconds(30));
+    }).get();
+    for (int i = 0; i < 200 && fired == 0; ++i)
+    {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    check(fired == 1 && full.stats().callerRuns >= 1, "due timer runs inline when the queue is full");
+    open = true;
+}
+
+// 队列满时的几种策略：一个线程堵住，队列上限2个，先塞满再挨个试
+void checkOverload()
+{
+    ThreadPool pool;
+    pool.setTaskCeiling(2);
+    pool.start(1);
+    atomic_bool open(false), holding(false);
+    pool.submitTask([&](){ holding = true; holdUntil(open); });
+    while (!holding)
+    {
+        this_thread::yield();
+    }
+    Future<int> oldest = pool.submitTask([](){ return 1; });
+    Future<int> second = pool.submitTask([](){ return 2; });
+
+    Submitted<int> rejected = pool.trySubmit([](){ return 3; });
+    check(rejected.status == tpSubmitStatus::REJECTED_ && !rejected, "trySubmit on a full queue is rejected");
+    try
+    {
+        rejected.future.get();
+        check(false, "rejected future throws SubmitRejected");
+    }
+    catch (const SubmitRejected &e)
+    {
+        check(e.status() == tpSubmitStatus::REJECTED_, "rejected future throws SubmitRejected");
+    }
+
+    auto begin = chrono::steady_clock::now();
+    Submitted<int> timedOut = pool.submitFor(chrono::milliseconds(20), [](){ return 4; });
+    check(timedOut.status == tpSubmitStatus::TIMEOUT_ && chrono::steady_clock::now() - begin >= chrono::milliseconds(20),
+          "submitFor times out after waiting");
+
+    SubmitOptions opt;
+    opt.overload = tpOverload::CALLER_RUNS_;
+    thread::id ranOn;
+    Submitted<int> inlined = pool.submitWith(opt, [&](){ ranOn = this_thread::get_id(); return 5; });
+    check(inlined.status == tpSubmitStatus::RAN_INLINE_ && ranOn == this_thread::get_id() && inlined.future.get() == 5,
+          "CALLER_RUNS_ runs on the submitting thread");
+
+    opt.overload = tpOverload::DROP_OLDEST_;
+    Submitted<int> replaced = pool.submitWith(opt, [](){ return 6; });
+    check(replaced.status == tpSubmitStatus::OK_, "DROP_OLDEST_ makes room");
+    try
+    {
+        oldest.get();
+        check(false, "dropped task's future gets broken_promise");
+    }
+    catch (const future_error &e)
+    {
+        check(e.code() == future_errc::broken_promise, "dropped task's future gets broken_promise");
+    }
+
+    PoolStats st = pool.stats();
+    check(st.rejected == 2 && st.callerRuns == 1 && st.dropped == 1, "overload counters");
+    open = true;
+    check(second.get() == 2 && replaced.future.get() == 6, "queued tasks still run after overload");
+}
+
+// 分治：任务里再提交子任务、等子任务的结果
+static int fib(FixedThreadPool &pool, int n)
+{
+    if (n < 2)
+    {
+        return n;
+    }
+    Future<int> left = pool.submitTask(fib, std::ref(pool), n - 1);
+    int right = fib(pool, n - 2);
+    return left.get() + right; // 在工作线程上get，等的时候帮着跑排队的任务
+}
+
+// 只有一个线程的fixed池，任务里嵌套get和TaskGroup::wait；等的时候不帮着跑的话这里会卡死
+void checkNestedWait()
+{
+    FixedThreadPool pool;
+    pool.start(1);
+    std::cout<<"nested wait on a 1-thread pool (hangs on regression)"<<std::endl;
+    check(pool.submitTask(fib, std::ref(pool), 15).get() == 610, "nested get on a 1-thread pool");
+
+    atomic_int leaves(0);
+    pool.submitTask([&](){
+        TaskGroup outer(pool);
+        for (int i = 0; i < 4; ++i)
+        {
+            outer.run([&](){
+                TaskGroup inner(pool);
+                for (int j = 0; j < 4; ++j)
+                {
+                    inner.run([&](){ leaves++; });
+                }
+                inner.wait();
+            });
+        }
+        outer.wait();
+    }).get();
+    check(leaves == 16, "nested TaskGroup::wait on a 1-thread pool");
+}
+
+// submitOrdered和Strand：同一个key的任务按提交顺序一个一个跑，不会两个同时跑；不同key之间不管
+void checkOrdered()
+{
+    const int KEYS = 3, EACH = 200; // key比线程少，不串行的话同一个key的任务一定会同时跑
+    ThreadPool pool;
+    pool.setTaskCeiling(4096);
+    pool.start(4);
+    vector<int> next(KEYS, 0);
+    vector<atomic_bool> inside(KEYS);
+    atomic_int wrongOrder(0), overlapped(0);
+    auto body = [&](int key, int seq){
+        if (inside[key].exchange(true))
+        {
+            overlapped++;
+        }
+        if (next[key] != seq) // 只有这个key自己的任务碰next[key]，串行的话不用加锁
+        {
+            wrongOrder++;
+        }
+        next[key] = seq + 1;
+        this_thread::sleep_for(chrono::microseconds(20)); // 拖一下，让别的线程有机会插进来
+        inside[key] = false;
+    };
+    vector<Future<void>> last;
+    for (int i = 0; i < EACH; ++i)
+    {
+        for (int key = 0; key < KEYS; ++key) // 各个key交错着提交
+        {
+            Future<void> f = pool.submitOrdered(key, body, key, i);
+            if (i == EACH - 1)
+            {
+                last.push_back(std::move(f));
+            }
+        }
+    }
+    for (auto &f : last)
+    {
+        f.get();
+    }
+    check(wrongOrder == 0 && overlapped == 0 && next == vector<int>(KEYS, EACH), "submitOrdered keeps per-key order");
+
+    // 一个Strand就是一个key
+    Strand strand(pool);
+    next[0] = 0;
+    wrongOrder = 0;
+    vector<Future<void>> all;
+    for (int i = 0; i < EACH; ++i)
+    {
+        all.push_back(strand.submitTask(body, 0, i));
+    }
+    for (auto &f : all)
+    {
+        f.get();
+    }
+    check(wrongOrder == 0 && overlapped == 0 && next[0] == EACH, "Strand runs tasks in order, one at a time");
+}
+
+// 排队时过了deadline、被cancel的任务：取到时不跑，future里是TaskDropped
+static tpDrop dropReason(Future<int> &f)
+{
+    try
+    {
+        f.get();
+    }
+    catch (const TaskDropped &e)
+    {
+        return e.reason();
+    }
+    return (tpDrop)-1;
+}
+
+void checkDeadline()
+{
+    ThreadPool pool;
+    pool.start(1);
+    atomic_bool open(false), holding(false);
+    atomic_int ran(0);
+    pool.submitTask([&](){ holding = true; holdUntil(open); });
+    while (!holding)
+    {
+        this_thread::yield();
+    }
+    auto now = chrono::steady_clock::now();
+    Future<int> expired = pool.submitBefore(now + chrono::milliseconds(5), [&](){ ran++; return 1; });
+    Future<int> inTime = pool.submitBefore(now + chrono::seconds(10), [&](){ ran++; return 2; });
+    CancelToken token = CancelToken::create();
+    Future<int> cancelled = pool.submitCancellable(token, [&](){ ran++; return 3; });
+    token.cancel();
+    this_thread::sleep_for(chrono::milliseconds(20)); // 排着队过了deadline
+    open = true;
+
+    check(dropReason(expired) == tpDrop::EXPIRED_, "task past its deadline is dropped with EXPIRED_");
+    check(dropReason(cancelled) == tpDrop::CANCELLED_, "cancelled task is dropped with CANCELLED_");
+    check(inTime.get() == 2 && ran == 1, "dropped task bodies never run");
+    PoolStats st = pool.stats();
+    check(st.expired == 1 && st.cancelled == 1, "expired/cancelled counters");
+}
+
+// 线程数是慢慢调过去的(缩的时候忙着的干完手上的才退)，最多等2s
+template <typename Pool>
+static bool threadsReach(Pool &pool, int n)
+{
+    for (int i = 0; i < 2000 && pool.stats().threads != n; ++i)
+    {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return pool.stats().threads == n;
+}
+
+// resize调线程数，setThreadCeiling卡上限；drain等所有任务跑完，池子还能接着用
+void checkResize()
+{
+    FixedThreadPool pool;
+    pool.start(2);
+    check(pool.resize(8) == 8 && threadsReach(pool, 8), "resize grows a fixed pool");
+    check(pool.resize(1) == 1 && threadsReach(pool, 1), "resize shrinks a fixed pool");
+    pool.setThreadCeiling(4);
+    check(pool.resize(100) == 4 && threadsReach(pool, 4), "resize stops at the thread ceiling");
+
+    atomic_int done(0);
+    for (int i = 0; i < 200; ++i)
+    {
+        pool.submitTask([&](){ this_thread::sleep_for(chrono::microseconds(100)); done++; });
+    }
+    check(pool.drain() && done == 200 && pool.stats().queued == 0, "drain returns after every task ran");
+
+    atomic_bool open(false);
+    pool.submitTask([&](){ holdUntil(open); });
+    check(!pool.drain(chrono::milliseconds(10)), "drain times out while a task is still running");
+    open = true;
+    check(pool.drain(), "drain succeeds once the task finishes");
+
+    // cached模式自己扩，扩不过上限；备用的线程也算在里面
+    ThreadPool cached;
+    cached.setPattren(tpPattern::CACHED_);
+    cached.setThreadCeiling(3);
+    cached.start(1);
+    atomic_int most(0);
+    done = 0;
+    for (int i = 0; i < 300; ++i)
+    {
+        cached.submitTask([&](){
+            int now = cached.stats().threads;
+            for (int seen = most; now > seen && !most.compare_exchange_weak(seen, now);)
+            {
+            }
+            this_thread::sleep_for(chrono::microseconds(200));
+            done++;
+        });
+    }
+    check(cached.drain() && done == 300, "drain on a cached pool");
+    check(most <= 3, "cached pool stays under its thread ceiling");
+}
+
 //适合高版本c++用户
 int main()
 {
@@ -21,10 +337,47 @@ int main()
 
     pool.start(2);
 
-    future<int> res = pool.submitTask(sum,1,2);
+    Future<int> res = pool.submitTask(sum,1,2);
     pool.submitTask(sum,1,2);
     pool.submitTask(sum,1,2);
     pool.submitTask(sum,1,2);
     pool.submitTask(sum,1,2);
     std::cout<<res.get()<<std::endl;
+
+    // 不用像InitVersion的debug.cc那样手动切区间、一个个拿Result
+    uint64_t total = pool.parallel_reduce(uint64_t(1), uint64_t(200000001), 1000000, uint64_t(0),
+                                          [](uint64_t i){ return i; },
+                                          [](uint64_t a, uint64_t b){ return a + b; });
+    std::cout<<total<<std::endl;
+
+    // 续体：前面的跑完了接着跑，中间不用get把线程堵住
+    std::vector<Future<int>> parts;
+    for (int i = 0; i < 4; ++i)
+    {
+        parts.push_back(pool.submitTask([i](){ return i * i; }));
+    }
+    Future<int> squares = when_all(std::move(parts)).then([](std::vector<int> v){
+        int s = 0;
+        for (int x : v) s += x;
+        return s;
+    });
+    std::cout<<squares.get()<<std::endl;
+
+    // 池子里面发生了什么：排队和执行时间的分布，每个线程干了多少
+    PoolStats st = pool.stats();
+    std::cout<<"queue wait p50/p99(ns): "<<st.queueWait.percentile(0.5)<<"/"<<st.queueWait.percentile(0.99)
+             <<"  exec p50/p99(ns): "<<st.execTime.percentile(0.5)<<"/"<<st.execTime.percentile(0.99)<<std::endl;
+    for (const WorkerStats &w : st.workers)
+    {
+        std::cout<<"worker "<<w.slot<<" tasks "<<w.tasks<<" busy(ms) "<<w.busyNs / 1000000<<" steals "<<w.steals<<std::endl;
+    }
+
+    checkTimers();
+    checkOverload();
+    checkNestedWait();
+    checkOrdered();
+    checkDeadline();
+    checkResize();
+    std::cout<<(bad == 0 ? "checks ok" : "checks FAILED")<<std::endl;
+    return bad == 0 ? 0 : 1;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <queue>
 #include <memory>
@@ -10,12 +11,36 @@
 #include <functional>
 #include <unordered_map>
 #include <thread>
-#include <future>
-#include <iostream>
+#include <iterator>
+#include <tuple>
+#include <stdexcept>
+
+#include "wsdeque.h"
+#include "mpmcqueue.h"
+#include "task.h"
+#include "future.h"
+#include "parallel.h"
+#include "timerwheel.h"
+#include "log.h"
+#include "stats.h"
+#include "numa.h"
+#include "coroutine.h"
+#include "taskgroup.h"
+#include "strand.h"
+#include "completion.h"
 
 const int TASKNUM_CEILING = 1024; // debug  INT32_MAX
 const int THREADNUM_CEILING = 512;
-const int THREADMAXIDLE = 60; // 单位:second
+const int CONTROL_INTERVAL_MS = 10;       // cached模式的控制线程多久看一次负载
+const int GROW_ROUNDS = 2;                // 连着几次排队超标才扩，抖一下不扩
+const int SHRINK_ROUNDS = 100;            // 连着几次(1s)都闲着才缩
+const int RESERVE_THREADS = 2;            // cached模式备着几个停好的线程，扩的时候叫醒就行，不用现场创建
+const uint32_t SOJOURN_TARGET_US = 1000;  // 任务排队超过这么久就该扩了
+const int SUBMIT_TIMEOUT_MS = 1000;       // 队列满时提交默认最多等多久
+const int DRAIN_POLL_MS = 1;              // 有定时任务到期还没放进队列时，drain隔多久再看一次
+const int LANE_NUM = 3;
+const int LANE_STARVE_ROUND = 8; // 每个线程每取8次任务，有一次从低优先级往高取，低优先级不会饿死
+const uint32_t SPIN_COUNT = 64;  // 停车前最多转几圈找任务
 
 // 线程池支持的模式
 enum class tpPattern // 限制enum的使用，防止多枚举冲突
@@ -24,6 +49,145 @@ enum class tpPattern // 限制enum的使用，防止多枚举冲突
     CACHED_, // 动态增长线程池
 };
 
+// 线程池的任务调度方式
+enum class tpSchedule
+{
+    SHARED_,   // 所有线程共用一个任务队列
+    STEALING_, // 每个线程一个本地队列，空闲线程去别的线程那里偷任务
+};
+
+// 全局任务队列的实现
+enum class tpQueue
+{
+    LOCKED_,   // std::queue + 每个节点一把锁
+    LOCKFREE_, // 有界无锁环形队列，容量取各lane的上限，start之后不再分配内存
+};
+
+// 任务优先级，每个优先级一条lane(一个全局队列)，取任务时高优先级先取
+enum class tpPriority
+{
+    HIGH_,   // 心跳、元数据这类延迟敏感的小RPC
+    NORMAL_, // 默认
+    LOW_,    // 大块传输这类批量活
+};
+
+// 队列满了提交怎么办
+enum class tpOverload
+{
+    BLOCK_,       // 等队列腾位置，最多等timeout，还满就拒(默认，等1s)
+    REJECT_,      // 不等，直接拒，IO线程用
+    CALLER_RUNS_, // 在提交的线程上直接跑，生产者自己慢下来
+    DROP_OLDEST_, // 丢掉同一条lane里最老的任务腾位置，被丢的任务的future拿到broken_promise
+};
+
+// 一次提交的结果
+enum class tpSubmitStatus
+{
+    OK_,         // 进队列了
+    RAN_INLINE_, // 队列满，CALLER_RUNS_在提交线程上跑完了，future已经就绪
+    REJECTED_,   // 队列满，没等
+    TIMEOUT_,    // 队列满，等了timeout还是满
+};
+
+// 排队的任务没跑就被扔掉的原因
+enum class tpDrop
+{
+    EXPIRED_,   // 取到时已经过了deadline
+    CANCELLED_, // 取到时CancelToken已经cancel了
+};
+
+// 取消标记，拷贝出来的都指向同一个标记；默认构造的是空的，不能cancel
+// 客户端断开、上游超时时cancel，还在排队的任务工作线程取到时直接扔掉
+class CancelToken
+{
+public:
+    CancelToken() = default;
+
+    static CancelToken create()
+    {
+        CancelToken t;
+        t.flag_ = std::make_shared<std::atomic_bool>(false);
+        return t;
+    }
+
+    void cancel() const
+    {
+        flag_->store(true, std::memory_order_release);
+    }
+
+    bool cancelled() const
+    {
+        return flag_ != nullptr && flag_->load(std::memory_order_acquire);
+    }
+
+    explicit operator bool() const
+    {
+        return flag_ != nullptr;
+    }
+
+private:
+    std::shared_ptr<std::atomic_bool> flag_;
+};
+
+const std::chrono::steady_clock::time_point NO_DEADLINE = std::chrono::steady_clock::time_point::max();
+
+// 每次提交单独指定的选项
+struct SubmitOptions
+{
+    tpPriority priority = tpPriority::NORMAL_;
+    tpOverload overload = tpOverload::BLOCK_;
+    std::chrono::nanoseconds timeout = std::chrono::milliseconds(SUBMIT_TIMEOUT_MS); // BLOCK_最多等多久
+    std::chrono::steady_clock::time_point deadline = NO_DEADLINE; // 过了还没开始跑就不跑了
+    CancelToken cancel;                                           // cancel了还没开始跑就不跑了
+};
+
+// 提交被拒时future里放的异常，get()抛出来，不会和正常的返回值混在一起
+class SubmitRejected : public std::runtime_error
+{
+public:
+    explicit SubmitRejected(tpSubmitStatus status)
+        : std::runtime_error(status == tpSubmitStatus::TIMEOUT_ ? "task queue full, submit timed out" : "task queue full, submit rejected"), status_(status)
+    {
+    }
+    tpSubmitStatus status() const
+    {
+        return status_;
+    }
+
+private:
+    tpSubmitStatus status_;
+};
+
+// 过期或者取消的任务没跑，future里放这个异常，和任务自己抛的、提交被拒的都分得开
+class TaskDropped : public std::runtime_error
+{
+public:
+    explicit TaskDropped(tpDrop reason)
+        : std::runtime_error(reason == tpDrop::EXPIRED_ ? "task deadline expired before it ran" : "task cancelled before it ran"), reason_(reason)
+    {
+    }
+    tpDrop reason() const
+    {
+        return reason_;
+    }
+
+private:
+    tpDrop reason_;
+};
+
+// trySubmit/submitFor/submitWith的返回值，被拒时不用get也能知道
+template <typename T>
+struct Submitted
+{
+    tpSubmitStatus status;
+    Future<T> future; // 被拒时里面是SubmitRejected
+
+    explicit operator bool() const
+    {
+        return status == tpSubmitStatus::OK_ || status == tpSubmitStatus::RAN_INLINE_;
+    }
+};
+
 //---------------------------------------------
 
 class Thread
@@ -57,21 +221,101 @@ int Thread::ididx_ = 0;
 
 //---------------------------------------------------------
 
-class ThreadPool
+// 编译期策略：模板参数定死的东西热路径上不再判断，用不上的功能整个编译掉
+// Runtime开头的按setter在运行时选，ThreadPool全用这几个，和以前一样
+
+// 队列策略：调度方式和全局队列的实现
+struct RuntimeQueue // setSchedule/setQueue选
+{
+    static constexpr bool runtime = true;
+    static constexpr tpSchedule schedule = tpSchedule::SHARED_; // 默认值
+    static constexpr tpQueue queue = tpQueue::LOCKED_;
+};
+
+template <tpSchedule S, tpQueue Q>
+struct StaticQueue
+{
+    static constexpr bool runtime = false;
+    static constexpr tpSchedule schedule = S;
+    static constexpr tpQueue queue = Q;
+};
+using SharedQueue = StaticQueue<tpSchedule::SHARED_, tpQueue::LOCKED_>;
+using SharedLockFreeQueue = StaticQueue<tpSchedule::SHARED_, tpQueue::LOCKFREE_>;
+using StealingQueue = StaticQueue<tpSchedule::STEALING_, tpQueue::LOCKED_>;
+using StealingLockFreeQueue = StaticQueue<tpSchedule::STEALING_, tpQueue::LOCKFREE_>;
+
+// 等待策略：找不到任务时要不要先转几圈再停车
+struct SpinThenPark // 转几圈由setSpinCount定
+{
+    static constexpr bool spin = true;
+};
+struct ParkOnly // 直接停车，线程比核多、不在乎唤醒延迟时用
+{
+    static constexpr bool spin = false;
+};
+
+// 线程数策略：fixed还是cached
+struct RuntimeGrowth // setPattren选
+{
+    static constexpr bool runtime = true;
+    static constexpr tpPattern pattern = tpPattern::FIXED_; // 默认值
+};
+
+template <tpPattern P>
+struct StaticGrowth
+{
+    static constexpr bool runtime = false;
+    static constexpr tpPattern pattern = P;
+};
+using FixedGrowth = StaticGrowth<tpPattern::FIXED_>;
+using CachedGrowth = StaticGrowth<tpPattern::CACHED_>;
+
+// 统计策略：关掉时任务不带时间戳，槽位上也没有直方图，fixed模式连完成数都不记
+struct DefaultStats // 跟着TP_STATS宏走
+{
+    static constexpr bool enabled = TP_STATS != 0;
+};
+struct WithStats
+{
+    static constexpr bool enabled = true;
+};
+struct NoStats
+{
+    static constexpr bool enabled = false;
+};
+
+template <typename QueuePolicy = RuntimeQueue, typename WaitPolicy = SpinThenPark, typename GrowthPolicy = RuntimeGrowth, typename StatsPolicy = DefaultStats>
+class BasicThreadPool final : public Executor
 {
+    // 只能移动，小任务不用额外new；开统计时带着提交时间算排队延迟
+    using Task = typename std::conditional<StatsPolicy::enabled, StampedTask, InlineTask>::type;
+
 public:
-    ThreadPool()
-        : threadsNum_(0), taskNum_(0), threadCeiling_(THREADNUM_CEILING), taskCeiling_(TASKNUM_CEILING), pattern_(tpPattern::FIXED_), started_(false), idleThreadsNum_(0), curThreadNum_(0)
+    BasicThreadPool()
+        : pattern_(GrowthPolicy::pattern), threadsNum_(0), threadCeiling_(THREADNUM_CEILING), curThreadNum_(0), idleThreadsNum_(0), queue_(QueuePolicy::queue), fullWaitersNum_(0), overload_(tpOverload::BLOCK_), submitTimeout_(std::chrono::milliseconds(SUBMIT_TIMEOUT_MS)), taskNum_(0), placement_(tpPlacement::NONE_), schedule_(QueuePolicy::schedule), sleepersNum_(0), spinCount_(std::thread::hardware_concurrency() > 1 ? SPIN_COUNT : 0), activeNum_(0), sojournTarget_(SOJOURN_TARGET_US), timerDeadline_(UINT64_MAX), timersNum_(0), timerWaiter_(-1), epoch_(std::chrono::steady_clock::now()), strands_(*this), started_(false)
     {
+        for (int i = 0; i < LANE_NUM; ++i)
+        {
+            laneCeiling_[i] = TASKNUM_CEILING;
+        }
     }
-    ~ThreadPool()
+    ~BasicThreadPool()
     {
         started_ = false;
+        if (controller_.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(ctrlMtx_);
+                ctrlCond_.notify_all();
+            }
+            controller_.join(); // 先停控制线程，后面不会再有新线程冒出来
+        }
+        // 线程：执行任务 或 停着  //停着的全叫醒，然后通过一个标记位做出不同动作
+        notifySleepers(SIZE_MAX);
+        releaseReserve(SIZE_MAX, ROLE_EXIT);
+
         // 等待线程池中所有线程返回
         std::unique_lock<std::mutex> lock(taskQueueMtx_);
-
-        // 线程：执行任务 或 在wait上等待  //直接唤醒，然后通过一个标记位做出不同动作
-        queueEmpty_.notify_all();
         exitCond_.wait(lock, [&]()
                        { return threads_.size() == 0; }); // 出现问题！！！别忘了通知！！
     }
@@ -81,222 +325,1912 @@ public:
         started_ = true;
         threadsNum_ = threadsNum;
         curThreadNum_ = threadsNum;
+        activeNum_ = threadsNum;
+
+        // 每个线程占一个槽位(本地队列等线程私有的东西放在这)，按线程上限留号，cached扩容、fixed模式resize都能调上去
+        // 没设setThreadCeiling就留THREADNUM_CEILING个号，但Worker只给起步的线程建，别的槽位第一次被占用时在spawnThread里建
+        int slotsNum = std::max(threadsNum_, threadCeiling_);
+        threadCeiling_ = slotsNum; // 之后线程数最多到槽位数
+        workers_.resize(slotsNum);
+        for (int i = 0; i < threadsNum_; ++i)
+        {
+            workers_[i].reset(new Worker(stealing(), spinCount_));
+        }
+        slotsHigh_ = threadsNum_;
+        for (int i = slotsNum - 1; i >= threadsNum_; --i)
+        {
+            freeSlots_.push_back(i);
+        }
+        placeWorkers();
 
         // 创建线程对象  但不是创建时启动
         for (int i = 0; i < threadsNum_; ++i)
         {
-            // threads_.emplace_back(new Thread(std::bind(&ThreadPool::threadFunc,this)));
-            std::unique_ptr<Thread> up(new Thread(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1)));
+            // threads_.emplace_back(new Thread(std::bind(&BasicThreadPool::threadFunc,this)));
+            std::unique_ptr<Thread> up(new Thread(std::bind(&BasicThreadPool::threadFunc, this, std::placeholders::_1, i)));
             int tid = up->getId();
             threads_.emplace(tid, std::move(up));
         }
 
         // 启动所有线程   threadfunc-- 等待任务队列中任务就绪，拿任务运行
-        for (int i = 0; i < threadsNum_; ++i)
+        // 线程id是全局递增的，第二个线程池的id不从0开始，所以直接遍历
+        for (auto &it : threads_)
         {
-            threads_[i]->start();
+            it.second->start();
             idleThreadsNum_++; // 空闲线程数
         }
+
+        // cached模式：先备好几个线程，再起控制线程按负载调上岗的线程数
+        if (cached())
+        {
+            {
+                std::lock_guard<std::mutex> lock(taskQueueMtx_);
+                for (int i = 0; i < RESERVE_THREADS && spawnThread(true); ++i)
+                {
+                }
+            }
+            controller_ = std::thread(&BasicThreadPool::controlLoop, this);
+        }
     }
 
     // 第二版 使用可变惨模板编程  让此接口能够接受任意函数和任意的参数个数
     // Result submitTask(Task *task);
     // 涉及引用折叠
     template <typename Func, typename... Args>
-    auto submitTask(Func &&func, Args &&...args) -> std::future<decltype(func(args...))>
+    auto submitTask(Func &&func, Args &&...args) -> Future<decltype(func(args...))>
     {
+        return submitTask(tpPriority::NORMAL_, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
 
-        using retType = decltype(func(args...)); // type !
-        // 堆上生成一个任务对象
-        auto task = std::make_shared<std::packaged_task<retType()>>(
-            std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
-        std::future<retType> result = task->get_future(); // package_task独有的get_future方法，返回一个future<?> 对象
-
-        std::unique_lock<std::mutex> lock(taskQueueMtx_);
+    // 指定优先级提交，放进对应的lane；队列满了按setOverload设的策略办
+    template <typename Func, typename... Args>
+    auto submitTask(tpPriority priority, Func &&func, Args &&...args) -> Future<decltype(func(args...))>
+    {
+        SubmitOptions opt;
+        opt.priority = priority;
+        opt.overload = overload_;
+        opt.timeout = submitTimeout_;
+        return submitWith(opt, std::forward<Func>(func), std::forward<Args>(args)...).future;
+    }
 
-        // 任务队列满，等待消费
-        // modern style -- lock,predicate_obj(overload)       //bool - waitfor超时时间为10s，最多等待10s
-        if (!queueFull_.wait_for(lock, std::chrono::seconds(1), [&](){ 
-            return taskNum_ < taskCeiling_; 
-        }))
-        {
-            std::cerr << "task queue still full, bad submit" << std::endl;
-            auto tmp = std::make_shared<std::packaged_task<retType()>>([](){ 
-                return retType(); 
+    // 同一个key(一般是连接id)的任务按提交顺序一个一个跑，不同key并行，RPC要按连接保序时用
+    // 等前面的任务时不占线程；按key排队的任务不受lane上限限制，overload策略也不管
+    template <typename Func, typename... Args>
+    auto submitOrdered(uint64_t key, Func &&func, Args &&...args) -> Future<decltype(func(args...))>
+    {
+        using retType = decltype(func(args...));
+        Promise<retType> promise;
+        promise.setExecutor(this);
+        Future<retType> result = promise.get_future();
+        strands_.post(key, [promise = std::move(promise), func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            promise.setWith([&]() -> retType {
+                return std::apply(func, args);
             });
-            (*tmp)(); //别忘记执行任务
-            return tmp->get_future();
-        }
-
-        // 任务队列有空余了 接着生产
-        // taskQueue_.emplace(sp);  Task是function<void()>  返回值void没有参数的函数对象 我们外套一层
-        taskQueue_.emplace([task](){
-            //套一层，对真实任务的封装
-            (*task)(); 
         });
-        taskNum_++;
+        return result;
+    }
 
-        queueEmpty_.notify_all(); // 绝对不空了，能来消费了
+    // 不阻塞：队列满了马上返回REJECTED_，调用者自己决定怎么卸载
+    template <typename Func, typename... Args>
+    auto trySubmit(Func &&func, Args &&...args) -> Submitted<decltype(func(args...))>
+    {
+        SubmitOptions opt;
+        opt.overload = tpOverload::REJECT_;
+        return submitWith(opt, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
 
-        // cached模式 任务处理比较紧急 适合：小而快的任务，耗时的任务会导致创建过多线程
-        if (pattern_ == tpPattern::CACHED_ && taskNum_ > idleThreadsNum_ && curThreadNum_ < threadCeiling_)
-        {
-            std::cout << " extern threads " << std::endl;
-            // 创建新线程对象添加到线程池中
-            std::unique_ptr<Thread> nt(new Thread(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1)));
-            int tid = nt->getId();
-            threads_.emplace(tid, std::move(nt));
-            threads_[tid]->start(); // 启动新线程
+    // 队列满了最多等timeout，还满返回TIMEOUT_
+    template <typename Rep, typename Period, typename Func, typename... Args>
+    auto submitFor(std::chrono::duration<Rep, Period> timeout, Func &&func, Args &&...args) -> Submitted<decltype(func(args...))>
+    {
+        SubmitOptions opt;
+        opt.timeout = timeout;
+        return submitWith(opt, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
 
-            curThreadNum_++;
-            idleThreadsNum_++;
-        }
+    // 带RPC的deadline提交：排队排过了deadline，工作线程取到时不跑，future里是TaskDropped(EXPIRED_)
+    template <typename Func, typename... Args>
+    auto submitBefore(std::chrono::steady_clock::time_point deadline, Func &&func, Args &&...args) -> Future<decltype(func(args...))>
+    {
+        SubmitOptions opt;
+        opt.overload = overload_;
+        opt.timeout = submitTimeout_;
+        opt.deadline = deadline;
+        return submitWith(opt, std::forward<Func>(func), std::forward<Args>(args)...).future;
+    }
 
-        return result;
+    // 带取消标记提交：还没开始跑时token被cancel了就不跑，future里是TaskDropped(CANCELLED_)
+    template <typename Func, typename... Args>
+    auto submitCancellable(const CancelToken &token, Func &&func, Args &&...args) -> Future<decltype(func(args...))>
+    {
+        SubmitOptions opt;
+        opt.overload = overload_;
+        opt.timeout = submitTimeout_;
+        opt.cancel = token;
+        return submitWith(opt, std::forward<Func>(func), std::forward<Args>(args)...).future;
     }
 
-    // setter
-    void setPattren(tpPattern pattern)
+    // 优先级、队列满时的策略、等多久、deadline、取消标记都单独指定
+    template <typename Func, typename... Args>
+    auto submitWith(const SubmitOptions &opt, Func &&func, Args &&...args) -> Submitted<decltype(func(args...))>
     {
-        if (PoolStatus())
-            return;
-        pattern_ = pattern;
+
+        using retType = decltype(func(args...)); // type !
+        // 共享状态从NodePool里拿，不用std::future每次new一个还要加锁
+        Promise<retType> promise;
+        promise.setExecutor(this); // future.then的续体回到这个线程池跑
+        Future<retType> result = promise.get_future();
+
+        // 函数和参数都移进lambda里，不像bind那样拷贝；调用时按左值传，和bind的语义一致
+        // 整个lambda放进Task的内联存储，典型的RPC handler提交一次不用new
+        // dropped不为空表示不跑了，把原因放进future
+        auto body = [promise = std::move(promise), func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)](const TaskDropped *dropped) mutable {
+            if (dropped != nullptr)
+            {
+                promise.set_exception(std::make_exception_ptr(*dropped));
+                return;
+            }
+            promise.setWith([&]() -> retType {
+                return std::apply(func, args);
+            });
+        };
+        // 没带deadline和取消标记的不多背这两样，免得撑出内联存储
+        Task job;
+        if (opt.deadline == NO_DEADLINE && !opt.cancel)
+        {
+            job = Task([body = std::move(body)]() mutable {
+                body(nullptr);
+            });
+        }
+        else
+        {
+            job = Task([this, body = std::move(body), deadline = opt.deadline, cancel = opt.cancel]() mutable {
+                if (cancel.cancelled())
+                {
+                    cancelledNum_++;
+                    TaskDropped dropped(tpDrop::CANCELLED_);
+                    body(&dropped);
+                }
+                else if (deadline != NO_DEADLINE && std::chrono::steady_clock::now() > deadline)
+                {
+                    expiredNum_++;
+                    TaskDropped dropped(tpDrop::EXPIRED_);
+                    body(&dropped);
+                }
+                else
+                {
+                    body(nullptr);
+                }
+            });
+        }
+
+        tpSubmitStatus status = enqueue(job, opt);
+        if (status != tpSubmitStatus::OK_ && status != tpSubmitStatus::RAN_INLINE_)
+        {
+            return {status, rejectedFuture<retType>(status)};
+        }
+        return {status, std::move(result)};
     }
-    void setTaskCeiling(uint16_t taskCeiling)
+
+    // 完成队列模式：跑完把(tag, 返回值)放进cq，不建future；IO线程从cq一次收一批结果
+    // 任务抛的异常放在Completion::error里；队列满了按setOverload的策略办，被拒的不会进cq，看返回值
+    // cq要活到提交的任务都跑完
+    template <typename T, typename Func, typename... Args>
+    tpSubmitStatus submitTo(CompletionQueue<T> &cq, uint64_t tag, Func &&func, Args &&...args)
     {
-        if (PoolStatus())
-            return;
-        taskCeiling_ = taskCeiling;
+        Task job([&cq, tag, func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            Completion<T> c;
+            c.tag = tag;
+            try
+            {
+                if constexpr (std::is_void_v<T>)
+                {
+                    std::apply(func, args);
+                }
+                else
+                {
+                    c.value.emplace(std::apply(func, args));
+                }
+            }
+            catch (...)
+            {
+                c.error = std::current_exception();
+            }
+            cq.push(std::move(c));
+        });
+        SubmitOptions opt;
+        opt.overload = overload_;
+        opt.timeout = submitTimeout_;
+        return enqueue(job, opt);
     }
-    void setThreadCeiling(uint16_t threadCeiling)
+
+    // Executor：then的续体、任务图里放行的节点从这进来
+    // 不能丢也不能让完成任务的线程干等，队列满了就在当前线程跑
+    void post(InlineTask fn) override
     {
-        if (PoolStatus())
+        Task job(std::move(fn));
+        if (stealing() && curPool_ == this)
         {
+            taskNum_++;
+            pushLocal(job);
+            notifySleepers();
             return;
         }
-        if (pattern_ == tpPattern::CACHED_)
+        if (pushQueue(job, (int)tpPriority::NORMAL_, tpOverload::REJECT_, std::chrono::nanoseconds(0)) != tpSubmitStatus::OK_)
         {
-            threadCeiling_ = threadCeiling;
+            callerRunsNum_++;
+            job();
         }
     }
 
-private:
-    // threadfunc defines here   为了线程函数能够使用线程池中的同步机制
-    void threadFunc(int threadID)
+    bool inWorker() const override
     {
-        auto lastTime = std::chrono::high_resolution_clock().now();
+        return curPool_ == this;
+    }
 
-        // 线程不是处理一个任务就万事大吉了，轮询拿任务
-        // while (started_)
-        for (;;) // 有任务要接着做
+    // 工作线程在任务里等池里的future/TaskGroup时调，找活的顺序和平时一样
+    // 跑的任务算在外面那个任务的执行时间里
+    bool runPending() override
+    {
+        if (curPool_ != this)
         {
-            Task task;  //以前的shared_ptr是用户传递的，所以为了保证生命周期才使用，现在的生命周期我们控制，不管了就
-            {
-                std::unique_lock<std::mutex> lock(taskQueueMtx_);
-
-                // cached模式 为了防止新创建出的空闲线程太多，设定线程空闲60s后就回收
-                // 时间计算： 当前时间 - 上一次线程执行时间 > 60s
-
-                // 反复调用wait，每一秒返回一次  使用waitfor返回值cv_status区分  (此版本一定会等待对应时间返回，无需条件)
-                while (/*started_ && */ taskNum_ == 0) // 任务队列中有任务了，才去消费
-                {
-                    if (!started_) // 1和3类都到此
-                    {
-                        // 线程池退出，任务执行完后的线程也要回收，别循环了 .2类
-                        threads_.erase(threadID);
-                        curThreadNum_--;
-                        std::cout << "thread " << std::this_thread::get_id() << "exit" << std::endl;
-                        exitCond_.notify_all();
-                        return; // 结束线程
-                    }
+            return false;
+        }
+        Task task;
+        if (!findTask(curSlot_, task))
+        {
+            return false;
+        }
+        idleThreadsNum_++; // findTask标记了忙，这个线程已经因为外面那个任务算着忙了
+        runTask(curSlot_, task);
+        return true;
+    }
 
-                    if (pattern_ == tpPattern::CACHED_)
-                    {
-                        // timeout no_timeout
-                        if (std::cv_status::timeout == queueEmpty_.wait_for(lock, std::chrono::seconds(1)))
-                        {
-                            auto now = std::chrono::high_resolution_clock().now();
-                            auto gap = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-                            if (gap.count() >= THREADMAXIDLE && curThreadNum_ > threadsNum_) // 至少留下初始化线程个数个
-                            {
-                                threads_.erase(threadID);
-                                curThreadNum_--;
-                                idleThreadsNum_--;
-
-                                std::cout << "thread " << std::this_thread::get_id() << "destroyed" << std::endl;
-                                return;
-                            }
-                        }
-                    }
-                    else // fixed
-                    {
-                        queueEmpty_.wait(lock);
-                    }
-                }
+#ifdef TP_COROUTINES
+    // co_await pool.schedule()之后协程在工作线程上接着跑
+    ScheduleAwaiter schedule()
+    {
+        return ScheduleAwaiter(*this);
+    }
 
-                idleThreadsNum_--;
-                std::cout << "tid" << std::this_thread::get_id() << "获取任务成功..." << std::endl;
+    // 把协程交给线程池跑，非协程代码用返回的Future等结果
+    template <typename T>
+    Future<T> spawn(pool_task<T> task)
+    {
+        return co_spawn(*this, std::move(task));
+    }
+#endif
 
-                // 消费
-                task = taskQueue_.front();
-                taskQueue_.pop();
-                --taskNum_;
+    // 一次提交一批无参任务，RPC分发线程一次epoll醒来解出一堆请求时用
+    // 整批只加一次锁，按任务数叫醒线程，cached模式也只判断一次要不要扩线程
+    // 可调用对象是拷贝进来的，想移动就传std::make_move_iterator
+    // 返回的future和[first, last)一一对应
+    template <typename It>
+    auto submitBatch(It first, It last) -> std::vector<Future<decltype((*first)())>>
+    {
+        return submitBatch(tpPriority::NORMAL_, first, last);
+    }
 
-                // extra 优化，通知其他线程还可以接着来拿了
-                if (taskNum_ > 0)
-                {
-                    queueEmpty_.notify_all();
-                }
+    template <typename It>
+    auto submitBatch(tpPriority priority, It first, It last) -> std::vector<Future<decltype((*first)())>>
+    {
+        using retType = decltype((*first)());
+        size_t n = std::distance(first, last);
+        std::vector<Future<retType>> results;
+        std::vector<Task> jobs;
+        results.reserve(n);
+        jobs.reserve(n);
+        for (; first != last; ++first)
+        {
+            Promise<retType> promise;
+            promise.setExecutor(this);
+            results.emplace_back(promise.get_future());
+            jobs.emplace_back([promise = std::move(promise), func = *first]() mutable {
+                promise.setWith(func);
+            });
+        }
 
-                // 简单一点，一有空位置就允许生产了
-                queueFull_.notify_all(); // 不满了，能生产了
+        size_t pushed = pushBatch(jobs, (int)priority, overload_, submitTimeout_);
+        if (pushed < n && overload_ == tpOverload::CALLER_RUNS_)
+        {
+            callerRunsNum_ += n - pushed;
+            for (size_t i = pushed; i < n; ++i)
+            {
+                jobs[i]();
             }
-            if (task != nullptr)
+        }
+        else if (pushed < n)
+        {
+            rejectedNum_ += n - pushed;
+            TP_LOG_WARN("task queue still full, bad submit %zu tasks", n - pushed);
+            tpSubmitStatus status = overload_ == tpOverload::BLOCK_ ? tpSubmitStatus::TIMEOUT_ : tpSubmitStatus::REJECTED_;
+            for (size_t i = pushed; i < n; ++i)
             {
-                task(); //functors
+                results[i] = rejectedFuture<retType>(status);
             }
-            idleThreadsNum_++;
-            lastTime = std::chrono::high_resolution_clock().now();
         }
+        return results;
     }
 
-    bool PoolStatus() const // true -- running
+    // 定时任务：delay之后丢进线程池(普通lane)跑，不要返回值，要结果就在fn里自己set一个Promise
+    // 没有单独的定时线程，空闲线程睡到时间轮的下一个事件为止；所有线程都在忙时会晚一点
+    template <typename Rep, typename Period, typename Func, typename... Args>
+    TimerHandle submitAfter(std::chrono::duration<Rep, Period> delay, Func &&func, Args &&...args)
     {
-        return started_;
+        return addTimer(std::chrono::steady_clock::now() + delay, 0,
+                        makeTimerTask(std::forward<Func>(func), std::forward<Args>(args)...));
     }
 
-private:
-    // 线程池工作模式
-    tpPattern pattern_;
-    // 线程列表
-    std::unordered_map<int, std::unique_ptr<Thread>> threads_;
-    // 初始化线程池数量
-    uint16_t threadsNum_;
-    // 线程数阈值 cached
-    uint16_t threadCeiling_;
-    // 线程池真实线程数量
-    std::atomic_int curThreadNum_;
-    // 空闲线程数量(cached模式下，如果空闲线程的数量达到一定阈值，那么要销毁一些)
-    std::atomic_uint idleThreadsNum_;
-
-    using Task = std::function<void()>;
-    std::queue<Task> taskQueue_; // 生命周期不由用户了，也不用写shared_ptr了
-    std::atomic_uint taskNum_;
+    template <typename Clock, typename Duration, typename Func, typename... Args>
+    TimerHandle submitAt(std::chrono::time_point<Clock, Duration> when, Func &&func, Args &&...args)
+    {
+        // system_clock之类的先换算成steady_clock
+        auto delay = when - Clock::now();
+        return addTimer(std::chrono::steady_clock::now() + delay, 0,
+                        makeTimerTask(std::forward<Func>(func), std::forward<Args>(args)...));
+    }
 
-    // 任务数阈值
-    uint32_t taskCeiling_;
+    // 每period跑一次，第一次在period之后；按固定频率，上一次还没跑完就跳过这一次
+    template <typename Rep, typename Period, typename Func, typename... Args>
+    TimerHandle submitEvery(std::chrono::duration<Rep, Period> period, Func &&func, Args &&...args)
+    {
+        uint64_t ticks = std::chrono::ceil<std::chrono::milliseconds>(period).count();
+        return addTimer(std::chrono::steady_clock::now() + period, ticks > 0 ? ticks : 1,
+                        makeTimerTask(std::forward<Func>(func), std::forward<Args>(args)...));
+    }
 
-    // 线程池启动状态，如果已经启动，则不允许再进行set
-    std::atomic_bool started_;
+    // 数据并行：[begin, end)里每个i调一次fn(i)，Index可以是整数也可以是随机访问迭代器
+    // grain是一块最少几个元素(0当1用)，块的大小自适应；调用者自己也抢块干活，不会干等
+    // end不在begin后面(空区间、反着的区间)什么都不做
+    template <typename Index, typename Fn>
+    void parallel_for(Index begin, Index end, size_t grain, Fn &&fn)
+    {
+        if (!(begin < end))
+        {
+            return;
+        }
+        size_t n = end - begin;
+        int participants = parallelParticipants(n, grain);
+        auto body = [&](size_t lo, size_t hi, int) {
+            for (size_t k = lo; k < hi; ++k)
+            {
+                fn(static_cast<Index>(begin + k));
+            }
+        };
+        parallelRun(n, grain, participants, body);
+    }
+
+    // 把每个map(i)用reduce合起来，reduce要满足结合律和交换律，identity是单位元
+    // 每个参与者攒一个部分结果，最后调用者合并，不用每块一个future
+    template <typename Index, typename T, typename MapFn, typename ReduceFn>
+    T parallel_reduce(Index begin, Index end, size_t grain, T identity, MapFn &&map, ReduceFn &&reduce)
+    {
+        struct alignas(64) Partial // 按缓存行隔开，别互相伪共享
+        {
+            T val;
+        };
+
+        if (!(begin < end))
+        {
+            return identity;
+        }
+        size_t n = end - begin;
+        int participants = parallelParticipants(n, grain);
+        std::vector<Partial> partials(participants, Partial{identity});
+        auto body = [&](size_t lo, size_t hi, int slot) {
+            T acc = identity;
+            for (size_t k = lo; k < hi; ++k)
+            {
+                acc = reduce(std::move(acc), map(static_cast<Index>(begin + k)));
+            }
+            partials[slot].val = reduce(std::move(partials[slot].val), std::move(acc));
+        };
+        parallelRun(n, grain, participants, body);
+
+        T result = identity;
+        for (auto &p : partials)
+        {
+            result = reduce(std::move(result), std::move(p.val));
+        }
+        return result;
+    }
+
+    // out[k] = fn(first[k])，两边都要是随机访问迭代器，返回输出的末尾
+    template <typename InIt, typename OutIt, typename Fn>
+    OutIt parallel_transform(InIt first, InIt last, OutIt out, size_t grain, Fn &&fn)
+    {
+        if (!(first < last))
+        {
+            return out;
+        }
+        size_t n = last - first;
+        int participants = parallelParticipants(n, grain);
+        auto body = [&](size_t lo, size_t hi, int) {
+            for (size_t k = lo; k < hi; ++k)
+            {
+                out[k] = fn(first[k]);
+            }
+        };
+        parallelRun(n, grain, participants, body);
+        return out + n;
+    }
+
+    // 运行时统计的快照，随时可以调；TP_STATS=0时只有线程数、任务数这些本来就有的计数
+    PoolStats stats() const
+    {
+        PoolStats st;
+        st.threads = curThreadNum_;
+        st.activeThreads = activeNum_;
+        st.idleThreads = idleThreadsNum_;
+        st.queued = taskNum_;
+        st.rejected = rejectedNum_;
+        st.dropped = droppedNum_;
+        st.callerRuns = callerRunsNum_;
+        st.expired = expiredNum_;
+        st.cancelled = cancelledNum_;
+        st.threadsCreated = createdNum_;
+        st.threadsDestroyed = destroyedNum_;
+        if constexpr (StatsPolicy::enabled)
+        {
+            // 只报占用过的槽位，留着给扩容的空槽位没有东西可报
+            int slots = slotsHigh_.load(std::memory_order_acquire);
+            for (int i = 0; i < slots; ++i)
+            {
+                const WorkerStatsCell &c = workers_[i]->stats;
+                st.workers.push_back(WorkerStats{i, workers_[i]->completed.get(), c.busyNs.get(), c.steals.get()});
+                c.queueWait.mergeInto(st.queueWait);
+                c.execTime.mergeInto(st.execTime);
+            }
+        }
+        return st;
+    }
+
+    // setter
+    // 下面三个只有对应的策略是Runtime的才起作用，模板参数定死的调了也不变
+    void setPattren(tpPattern pattern)
+    {
+        if (PoolStatus() || !GrowthPolicy::runtime)
+            return;
+        pattern_ = pattern;
+    }
+    // 所有lane的任务数上限，运行中也能调
+    void setTaskCeiling(uint16_t taskCeiling)
+    {
+        for (int i = 0; i < LANE_NUM; ++i)
+        {
+            setLaneCeiling((tpPriority)i, taskCeiling);
+        }
+    }
+    // 单独一条lane的任务数上限，比如批量lane开小一点，满了让上游慢下来
+    // 运行中调小，已经排着的不扔，只是新的进不来；lockfree模式的环形队列start时定了大小，最多调回那么大
+    void setLaneCeiling(tpPriority priority, uint16_t taskCeiling)
+    {
+        int lane = (int)priority;
+        std::lock_guard<std::mutex> ctrl(ctrlMtx_);
+        laneCeiling_[lane] = taskCeiling;
+        if (!PoolStatus())
+            return;
+        int nodesNum = nodes_.size();
+        for (auto &q : nodes_)
+        {
+            uint32_t c = (taskCeiling + nodesNum - 1) / nodesNum;
+            if (lockfree())
+            {
+                c = std::min<uint32_t>(c, q->rings[lane]->capacity());
+            }
+            q->laneCeiling[lane].store(c, std::memory_order_relaxed);
+        }
+        // 调大了，在等位置的生产者可以再试一次
+        std::lock_guard<std::mutex> lock(taskQueueMtx_);
+        queueFull_.notify_all();
+    }
+    void setSchedule(tpSchedule schedule)
+    {
+        if (PoolStatus() || !QueuePolicy::runtime)
+            return;
+        schedule_ = schedule;
+    }
+    void setQueue(tpQueue queue)
+    {
+        if (PoolStatus() || !QueuePolicy::runtime)
+            return;
+        queue_ = queue;
+    }
+    // 线程找不到任务时停车前最多转几圈，0就是直接停；默认多核64圈，单核不转(转了也只是抢生产者的CPU)
+    // ParkOnly策略下不转，这个不起作用
+    void setSpinCount(uint32_t spinCount)
+    {
+        if (PoolStatus())
+            return;
+        spinCount_ = spinCount;
+    }
+    // 绑核方式；SPREAD_/COMPACT_按NUMA拓扑放线程，除了NONE_都是每个节点一组队列
+    // 提交优先放进提交线程所在的节点，那个节点的线程都在忙而别的节点有空闲线程时才溢出过去
+    void setPlacement(tpPlacement placement)
+    {
+        if (PoolStatus())
+            return;
+        placement_ = placement;
+    }
+    // 自己指定每个槽位绑哪些cpu，第i个槽位用cpuSets[i % n]，隐含PINNED_
+    void setCpuSets(std::vector<std::vector<int>> cpuSets)
+    {
+        if (PoolStatus())
+            return;
+        cpuSets_ = std::move(cpuSets);
+        placement_ = tpPlacement::PINNED_;
+    }
+    // 不用sysfs读到的拓扑，比如单节点的机器上用NumaTopology::parse("0;0")测两个节点的逻辑
+    void setTopology(NumaTopology topology)
+    {
+        if (PoolStatus())
+            return;
+        topology_ = std::move(topology);
+    }
+    // cached模式下任务排队超过多久就扩线程，默认1ms；延迟敏感的调小，扩得更积极
+    void setSojournTarget(std::chrono::microseconds target)
+    {
+        if (PoolStatus())
+            return;
+        sojournTarget_ = target.count();
+    }
+    // submitTask/submitBatch在队列满时的策略，默认BLOCK_最多等1s
+    // 每次提交单独指定用submitWith/trySubmit/submitFor
+    void setOverload(tpOverload overload, std::chrono::milliseconds timeout = std::chrono::milliseconds(SUBMIT_TIMEOUT_MS))
+    {
+        if (PoolStatus())
+            return;
+        overload_ = overload;
+        submitTimeout_ = timeout;
+    }
+    // cached模式最多扩到几个线程；fixed模式是resize最多能调到几个，start时按这个数留槽位
+    // 运行中只能在start时留的槽位数以内调，调到比现有线程少时多出来的按resize缩的办法退
+    void setThreadCeiling(uint16_t threadCeiling)
+    {
+        std::lock_guard<std::mutex> ctrl(ctrlMtx_);
+        if (!PoolStatus())
+        {
+            threadCeiling_ = threadCeiling;
+            return;
+        }
+        threadCeiling = std::max<uint16_t>(1, std::min<size_t>(threadCeiling, workers_.size()));
+        {
+            std::lock_guard<std::mutex> lock(taskQueueMtx_); // spawnThread在这把锁里看上限
+            threadCeiling_ = threadCeiling;
+        }
+        if (threadsNum_ > threadCeiling)
+        {
+            threadsNum_ = threadCeiling;
+        }
+        if (activeNum_ - retireNum_ > threadCeiling)
+        {
+            resizeLocked(threadCeiling);
+        }
+    }
+
+    // 运行中调线程数(cached模式下是控制线程缩容的下限)，最多到setThreadCeiling/start时留的槽位数
+    // 多了先叫醒备用的，不够再创建；少了先退停着的，不够的等忙着的干完手上这个任务再退，不丢任务
+    // 返回调完的目标线程数
+    int resize(int threadsNum)
+    {
+        std::lock_guard<std::mutex> ctrl(ctrlMtx_); // 和控制线程、别的resize错开
+        if (!PoolStatus())
+        {
+            return 0;
+        }
+        threadsNum = std::max(1, std::min<int>(threadsNum, threadCeiling_));
+        threadsNum_ = threadsNum;
+        resizeLocked(threadsNum);
+        return threadsNum;
+    }
+
+    // 等队列里的任务都跑完、线程都闲下来，线程池不拆，还能接着用；超时返回false
+    // 算不算：strand里排着的算(排空任务跑完前把自己再放回池子)，已经到期的定时任务算，还没到期的不算
+    // 压测、出事时调完容量等一等看效果；池内线程调的话不算自己，等的时候帮着跑
+    // 不轮询：线程跑完任务闲下来、提交失败把计数退回去时，看到有人在等就叫一下
+    bool drain(std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+    {
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        if (timeout != std::chrono::milliseconds::max())
+        {
+            deadline = std::chrono::steady_clock::now() + timeout;
+        }
+        int self = curPool_ == this ? 1 : 0;
+        // 先看taskNum_再看忙的线程：取任务的线程先标记忙再减taskNum_，中间没有两边都看不到的空档
+        auto quiet = [&]() {
+            return taskNum_ == 0 && curThreadNum_ - (int)idleThreadsNum_ <= self && !timerDue();
+        };
+
+        bool ok = true;
+        drainWaiters_++; // 和notifyDrain里先改计数再看drainWaiters_配对
+        std::unique_lock<std::mutex> lock(taskQueueMtx_);
+        while (!quiet())
+        {
+            if (self == 1)
+            {
+                lock.unlock();
+                bool ran = runPending();
+                lock.lock();
+                if (ran)
+                {
+                    continue;
+                }
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                ok = false;
+                break;
+            }
+            if (timerDue())
+            {
+                // 到期的还在时间轮里，放进队列时不叫人，过一会儿再看
+                drainCond_.wait_until(lock, std::min(deadline, now + std::chrono::milliseconds(DRAIN_POLL_MS)));
+            }
+            else if (deadline == std::chrono::steady_clock::time_point::max())
+            {
+                drainCond_.wait(lock);
+            }
+            else
+            {
+                drainCond_.wait_until(lock, deadline);
+            }
+        }
+        lock.unlock();
+        drainWaiters_--;
+        return ok;
+    }
+
+private:
+    // 按opt放进队列；CALLER_RUNS_放不进去时在这里跑掉，返回RAN_INLINE_
+    tpSubmitStatus enqueue(Task &job, const SubmitOptions &opt)
+    {
+        // stealing模式下，池内线程提交的普通任务直接放进自己的本地队列，不碰全局锁
+        // 本地队列不受lane上限限制：工作线程阻塞等队列不满，很容易把自己锁死
+        // 高低优先级的还是进lane，本地队列不分优先级
+        if (stealing() && curPool_ == this && opt.priority == tpPriority::NORMAL_)
+        {
+            taskNum_++; // 先计数再入队，偷走的线程减计数时不会减到负数
+            pushLocal(job);
+            notifySleepers();
+            return tpSubmitStatus::OK_;
+        }
+
+        tpSubmitStatus status = pushQueue(job, (int)opt.priority, opt.overload, opt.timeout);
+        if (status == tpSubmitStatus::REJECTED_ && opt.overload == tpOverload::CALLER_RUNS_)
+        {
+            callerRunsNum_++;
+            job();
+            return tpSubmitStatus::RAN_INLINE_;
+        }
+        if (status != tpSubmitStatus::OK_)
+        {
+            rejectedNum_++;
+            TP_LOG_WARN("task queue still full, bad submit");
+        }
+        return status;
+    }
+
+    // 队列满了提交失败，返回一个已经就绪的future，get()抛SubmitRejected
+    template <typename R>
+    static Future<R> rejectedFuture(tpSubmitStatus status)
+    {
+        Promise<R> tmp;
+        tmp.set_exception(std::make_exception_ptr(SubmitRejected(status)));
+        return tmp.get_future();
+    }
+
+    template <typename Func, typename... Args>
+    static InlineTask makeTimerTask(Func &&func, Args &&...args)
+    {
+        return InlineTask([func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            try
+            {
+                std::apply(func, args);
+            }
+            catch (...)
+            {
+                // 没有future接异常，别让它把工作线程带走
+                TP_LOG_ERROR("timer task throw exception");
+            }
+        });
+    }
+
+    TimerHandle addTimer(std::chrono::steady_clock::time_point when, uint64_t period, InlineTask fn)
+    {
+        auto job = std::make_shared<TimerJob>(std::move(fn), period);
+        bool earlier;
+        {
+            std::lock_guard<std::mutex> lock(timerMtx_);
+            wheel_.add(toTick(when), job);
+            timersNum_++;
+            uint64_t next = wheel_.nextEvent();
+            earlier = next < timerDeadline_;
+            timerDeadline_ = next;
+        }
+        // 比掐表的线程等的时间早，让一个停着的线程重新掐表
+        if (earlier && sleepersNum_ > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(parkMtx_);
+                timerWaiter_ = -1;
+            }
+            notifySleepers();
+        }
+        return TimerHandle(job);
+    }
+
+    // 时间轮走到现在，到期的一起扔进普通lane，周期任务顺手挂回去
+    // 每个工作线程取任务前都调一下，没有定时任务时只多读一个原子变量
+    void fireTimers()
+    {
+        if (timersNum_ == 0 || !started_ || timerDeadline_ > nowTick())
+        {
+            return;
+        }
+
+        std::vector<Task> due;
+        {
+            std::lock_guard<std::mutex> lock(timerMtx_);
+            uint64_t now = nowTick();
+            wheel_.advance(now, [&](uint64_t expire, std::shared_ptr<TimerJob> &&job) {
+                if (job->cancelled)
+                {
+                    timersNum_--;
+                    return;
+                }
+                due.emplace_back([job]() {
+                    job->run();
+                });
+                if (job->period == 0)
+                {
+                    timersNum_--;
+                    return;
+                }
+                // 错过的周期不补，直接排到now之后的下一个周期点
+                uint64_t next = expire + job->period;
+                if (next <= now)
+                {
+                    next = expire + job->period * ((now - expire) / job->period + 1);
+                }
+                wheel_.add(next, std::move(job));
+            });
+            timerDeadline_ = wheel_.nextEvent();
+        }
+
+        // 和post一样：只有工作线程会走到这，不能等队列腾位置(腾位置的就是工作线程)，也不能丢，放不进去的就地跑
+        size_t pushed = pushBatch(due, (int)tpPriority::NORMAL_, tpOverload::REJECT_, std::chrono::nanoseconds(0));
+        if (pushed < due.size())
+        {
+            callerRunsNum_ += due.size() - pushed;
+            for (size_t i = pushed; i < due.size(); ++i)
+            {
+                due[i]();
+            }
+        }
+    }
+
+    // 时间轮的tick是从epoch_开始的毫秒数
+    uint64_t nowTick() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch_).count();
+    }
+    uint64_t toTick(std::chrono::steady_clock::time_point t) const
+    {
+        return t <= epoch_ ? 0 : std::chrono::ceil<std::chrono::milliseconds>(t - epoch_).count();
+    }
+
+    bool timerDue() const
+    {
+        return timersNum_ > 0 && timerDeadline_ <= nowTick();
+    }
+
+    // 参与者数：块数和线程数取小的，池内线程调用时自己算一个
+    int parallelParticipants(size_t n, size_t &grain)
+    {
+        if (grain == 0)
+        {
+            grain = 1;
+        }
+        size_t chunks = (n + grain - 1) / grain;
+        size_t helpers = activeNum_ > 0 ? activeNum_ - (curPool_ == this ? 1 : 0) : 0;
+        return (int)std::min(chunks, helpers + 1);
+    }
+
+    // 给participants-1个线程各派一个帮手任务，调用者当0号参与者，最后等手上还在跑的块
+    template <typename Body>
+    void parallelRun(size_t n, size_t grain, int participants, Body &body)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+        auto state = std::make_shared<ParallelState<Body>>(&body, n, grain, participants);
+        if (participants > 1 && started_)
+        {
+            std::vector<Task> jobs;
+            jobs.reserve(participants - 1);
+            for (int i = 1; i < participants; ++i)
+            {
+                jobs.emplace_back([state, i]() {
+                    state->work(i);
+                });
+            }
+            // 没放进去的帮手不用在这跑，调用者自己多干点；所以队列满了也不等，池内线程调的话等了还可能把自己堵死
+            pushBatch(jobs, (int)tpPriority::NORMAL_, tpOverload::REJECT_, std::chrono::nanoseconds(0));
+        }
+        state->work(0);
+        state->wait();
+    }
+
+    // 定起步的槽位绑哪些cpu、属于哪个节点，再按节点建队列，每个节点分到lane上限的1/节点数
+    void placeWorkers()
+    {
+        int nodesNum = 1;
+        if (placement_ != tpPlacement::NONE_)
+        {
+            if (topology_.nodes.empty())
+            {
+                topology_ = NumaTopology::detect();
+            }
+            nodesNum = topology_.nodes.size();
+            for (int n = 0; n < nodesNum; ++n)
+            {
+                for (int cpu : topology_.nodes[n])
+                {
+                    if (cpu >= (int)cpuNode_.size())
+                    {
+                        cpuNode_.resize(cpu + 1, 0);
+                    }
+                    cpuNode_[cpu] = n;
+                }
+            }
+        }
+        for (int i = 0; i < threadsNum_; ++i)
+        {
+            placeSlot(i);
+        }
+
+        for (int n = 0; n < nodesNum; ++n)
+        {
+            nodes_.emplace_back(new NodeQueues());
+            for (int i = 0; i < LANE_NUM; ++i)
+            {
+                NodeQueues &q = *nodes_.back();
+                q.laneCeiling[i] = (laneCeiling_[i] + nodesNum - 1) / nodesNum;
+                if (lockfree())
+                {
+                    q.rings[i].reset(new MPMCQueue<Task>(q.laneCeiling[i].load()));
+                }
+            }
+        }
+    }
+
+    // 第i个槽位绑哪些cpu、属于哪个节点；start和第一次占用这个槽位时调
+    void placeSlot(int i)
+    {
+        Worker &w = *workers_[i];
+        if (placement_ == tpPlacement::PINNED_ && !cpuSets_.empty())
+        {
+            w.cpus = cpuSets_[i % cpuSets_.size()];
+            w.node = w.cpus.empty() ? 0 : topology_.nodeOf(w.cpus[0]);
+        }
+        else if (placement_ == tpPlacement::SPREAD_)
+        {
+            // 第i个槽位放到i%节点数号节点，用这个节点里的下一个cpu
+            int nodesNum = topology_.nodes.size();
+            w.node = i % nodesNum;
+            const std::vector<int> &cpus = topology_.nodes[w.node];
+            w.cpus = {cpus[(i / nodesNum) % cpus.size()]};
+        }
+        else if (placement_ == tpPlacement::COMPACT_)
+        {
+            // 所有cpu按节点顺序排成一列，第i个槽位用第i个
+            size_t total = 0;
+            for (auto &cpus : topology_.nodes)
+            {
+                total += cpus.size();
+            }
+            size_t k = i % total;
+            for (auto &cpus : topology_.nodes)
+            {
+                if (k < cpus.size())
+                {
+                    w.cpus = {cpus[k]};
+                    break;
+                }
+                k -= cpus.size();
+            }
+            w.node = topology_.nodeOf(w.cpus[0]);
+        }
+    }
+
+    // 提交的线程在哪个节点：池内线程看槽位，外部线程看现在跑在哪个cpu上
+    int localNode() const
+    {
+        if (nodes_.size() == 1)
+        {
+            return 0;
+        }
+        if (curPool_ == this)
+        {
+            return workers_[curSlot_]->node;
+        }
+        int cpu = sched_getcpu();
+        return cpu >= 0 && cpu < (int)cpuNode_.size() ? cpuNode_[cpu] : 0;
+    }
+
+    // 放到哪个节点：本节点的线程都在忙而别的节点有停着的线程，才溢出过去
+    int pickNode() const
+    {
+        int node = localNode();
+        if (nodes_.size() == 1 || nodes_[node]->parked > 0)
+        {
+            return node;
+        }
+        for (size_t i = 1; i < nodes_.size(); ++i)
+        {
+            int other = (node + i) % nodes_.size();
+            if (nodes_[other]->parked > 0)
+            {
+                return other;
+            }
+        }
+        return node;
+    }
+
+    // 往一个节点的lane里放，放满为止，返回放进去前几个
+    size_t tryPushNode(Task *jobs, size_t n, int lane, int node)
+    {
+        NodeQueues &q = *nodes_[node];
+        size_t pushed = 0;
+        uint32_t ceiling = q.laneCeiling[lane].load(std::memory_order_relaxed);
+        uint32_t before = q.laneNum[lane].fetch_add(n); // 先计数再入队，消费者减计数时不会减到负数
+        if (lockfree())
+        {
+            // 环形队列本身装满为止；运行中调小过上限的，按计数再卡一下
+            while (pushed < n && before + pushed < ceiling && q.rings[lane]->tryPush(jobs[pushed]))
+            {
+                pushed++;
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(q.mtx);
+            for (; pushed < n && q.lanes[lane].size() < ceiling; ++pushed)
+            {
+                q.lanes[lane].emplace(std::move(jobs[pushed]));
+            }
+        }
+        q.laneNum[lane] -= n - pushed;
+        return pushed;
+    }
+
+    // 先放首选节点，放不下再挨个放别的节点
+    size_t tryPush(Task *jobs, size_t n, int lane, int node)
+    {
+        size_t pushed = 0;
+        for (size_t i = 0; i < nodes_.size() && pushed < n; ++i)
+        {
+            pushed += tryPushNode(jobs + pushed, n - pushed, lane, (node + i) % nodes_.size());
+        }
+        return pushed;
+    }
+
+    // 放进全局队列，不加taskQueueMtx_；所有节点都满了按overload办，没放进去job还在原处
+    // CALLER_RUNS_在这里和REJECTED_一样，由调用者自己跑
+    tpSubmitStatus pushQueue(Task &job, int lane, tpOverload overload, std::chrono::nanoseconds timeout)
+    {
+        int node = pickNode();
+        taskNum_++; // 先计数再入队，消费者减计数时不会减到负数
+        if (tryPush(&job, 1, lane, node) == 0)
+        {
+            tpSubmitStatus status = overflow(job, lane, node, overload, timeout);
+            if (status != tpSubmitStatus::OK_)
+            {
+                taskNum_--;
+                notifyDrain();
+                return status;
+            }
+        }
+        // 绝对不空了，能来消费了，一个任务只叫醒一个
+        notifySleepers(1, node);
+        return tpSubmitStatus::OK_;
+    }
+
+    // 队列满了：BLOCK_拿锁等位置，DROP_OLDEST_丢掉这条lane最老的任务，其他的直接不放
+    // 调用者已经给job加过taskNum_
+    tpSubmitStatus overflow(Task &job, int lane, int node, tpOverload overload, std::chrono::nanoseconds timeout)
+    {
+        if (overload == tpOverload::DROP_OLDEST_)
+        {
+            for (;;)
+            {
+                if (tryPush(&job, 1, lane, node) == 1)
+                {
+                    return tpSubmitStatus::OK_;
+                }
+                Task old;
+                if (!popLane(old, lane, node))
+                {
+                    return tpSubmitStatus::REJECTED_; // 满的是别的节点，这条lane没东西可丢
+                }
+                --taskNum_;
+                droppedNum_++;
+                TP_LOG_WARN("task queue full, drop the oldest task");
+                // old在这里析构，里面的Promise给future设broken_promise
+            }
+        }
+        if (overload != tpOverload::BLOCK_ || timeout <= timeout.zero())
+        {
+            return tpSubmitStatus::REJECTED_;
+        }
+
+        std::unique_lock<std::mutex> lock(taskQueueMtx_);
+        // modern style -- lock,predicate_obj(overload)
+        fullWaitersNum_++;
+        bool ok = queueFull_.wait_for(lock, timeout, [&](){
+            return tryPush(&job, 1, lane, node) == 1;
+        });
+        fullWaitersNum_--;
+        return ok ? tpSubmitStatus::OK_ : tpSubmitStatus::TIMEOUT_;
+    }
+
+    // 成批入队，返回前多少个入队成功了；放不下的按overload一个个处理，有一个不成后面的就不要了
+    size_t pushBatch(std::vector<Task> &jobs, int lane, tpOverload overload, std::chrono::nanoseconds timeout)
+    {
+        size_t n = jobs.size();
+        if (n == 0)
+        {
+            return 0;
+        }
+
+        if (stealing() && curPool_ == this && lane == (int)tpPriority::NORMAL_)
+        {
+            taskNum_ += n;
+            for (auto &job : jobs)
+            {
+                pushLocal(job);
+            }
+            notifySleepers(n);
+            return n;
+        }
+
+        int node = pickNode();
+        taskNum_ += n;
+        size_t pushed = tryPush(jobs.data(), n, lane, node);
+        if (pushed < n)
+        {
+            // 放不下了，先把没进队列的从计数里拿掉，叫醒线程去消费已经进去的，再一个个处理
+            taskNum_ -= n - pushed;
+            notifySleepers(pushed, node);
+            for (; pushed < n; ++pushed)
+            {
+                taskNum_++;
+                if (overflow(jobs[pushed], lane, node, overload, timeout) != tpSubmitStatus::OK_)
+                {
+                    taskNum_--;
+                    notifyDrain();
+                    break;
+                }
+                notifySleepers(1, node);
+            }
+        }
+        else
+        {
+            notifySleepers(pushed, node);
+        }
+        return pushed;
+    }
+
+    // 放进当前线程的本地队列；节点从NodePool拿，谁取走谁还回去，嵌套提交不用每次new
+    void pushLocal(Task &job)
+    {
+        LocalNode *n = NodePool<LocalNode>::get();
+        n->task = std::move(job);
+        workers_[curSlot_]->deque->push(n);
+    }
+
+    // 这次取任务要不要反过来从低优先级往高取，只有槽位的主人线程会调
+    bool starveRound(int slot)
+    {
+        return ++workers_[slot]->popCount % LANE_STARVE_ROUND == 0;
+    }
+
+    // 从前lanes个优先级的全局队列里取一个任务，reverse时从低往高取
+    // 同一优先级先取node节点的，空了再取别的节点的，不让任务因为放错了节点干等着
+    bool popInject(Task &task, bool reverse, int lanes, int node)
+    {
+        size_t nodesNum = nodes_.size();
+        for (int i = 0; i < lanes; ++i)
+        {
+            int lane = reverse ? LANE_NUM - 1 - i : i;
+            for (size_t k = 0; k < nodesNum; ++k)
+            {
+                int from = (node + k) % nodesNum;
+                if (nodes_[from]->laneNum[lane] > 0 && popNode(from, lane, task)) // 空的就别去抢锁了
+                {
+                    idleThreadsNum_--; // 先标记忙再减taskNum_，drain看不到两边都空的空档
+                    --taskNum_;
+                    // 和pushQueue里先登记fullWaitersNum_再tryPush配对，不会丢唤醒
+                    // 一有空位置就允许生产了，没有生产者在等就不用通知
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (fullWaitersNum_ > 0)
+                    {
+                        std::lock_guard<std::mutex> lock(taskQueueMtx_);
+                        queueFull_.notify_all();
+                    }
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // DROP_OLDEST_用：从这条lane里取最老的，先看node节点
+    bool popLane(Task &task, int lane, int node)
+    {
+        for (size_t k = 0; k < nodes_.size(); ++k)
+        {
+            int from = (node + k) % nodes_.size();
+            if (nodes_[from]->laneNum[lane] > 0 && popNode(from, lane, task))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool popNode(int node, int lane, Task &task)
+    {
+        NodeQueues &q = *nodes_[node];
+        if (lockfree())
+        {
+            if (!q.rings[lane]->tryPop(task))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (q.lanes[lane].empty())
+            {
+                return false;
+            }
+            task = std::move(q.lanes[lane].front());
+            q.lanes[lane].pop();
+        }
+        --q.laneNum[lane];
+        return true;
+    }
+
+    // cached模式的控制线程：每CONTROL_INTERVAL_MS看一眼排队时间和忙闲，调上岗的线程数
+    // 提交路径上不再创建线程，扩的时候先叫醒备用线程，叫醒是微秒级的
+    // 调用者持有ctrlMtx_；activeNum_里还没退掉的(retireNum_)不算
+    void resizeLocked(int target)
+    {
+        int active = activeNum_ - retireNum_;
+        if (target > active)
+        {
+            int want = target - active;
+            want -= takeRetire(want); // 还没退的先不退了
+            int got = releaseReserve(want, ROLE_ACTIVE);
+            activeNum_ += got;
+            std::lock_guard<std::mutex> lock(taskQueueMtx_);
+            for (; got < want && spawnThread(false); ++got)
+            {
+                activeNum_++;
+            }
+            TP_LOG_INFO("resize to %d threads, %d active", target, activeNum_.load());
+        }
+        else if (target < active)
+        {
+            int excess = active - target;
+            int got = demote(excess);
+            activeNum_ -= got;
+            if (!cached())
+            {
+                releaseReserve(got, ROLE_EXIT); // fixed模式没有控制线程管备用的，直接退
+            }
+            retireNum_ += excess - got;
+            notifySleepers(excess - got); // 忙着的干完就退；万一这时候停下了，叫起来看一眼
+            TP_LOG_INFO("resize to %d threads, %d retire after current task", target, excess - got);
+        }
+    }
+
+    // 从retireNum_里拿至多n个名额，返回拿到几个
+    int takeRetire(int n)
+    {
+        int cur = retireNum_.load(std::memory_order_relaxed);
+        int take;
+        do
+        {
+            take = std::min(cur, n);
+            if (take <= 0)
+            {
+                return 0;
+            }
+        } while (!retireNum_.compare_exchange_weak(cur, cur - take, std::memory_order_relaxed));
+        return take;
+    }
+
+    // resize缩容时没有停着的线程可退，忙着的线程干完手上的任务来这里领一个名额退出
+    // 本地队列里还有任务的先不退，干完再说
+    bool retire(int threadID, int slot)
+    {
+        if (stealing() && !workers_[slot]->deque->empty())
+        {
+            return false;
+        }
+        if (takeRetire(1) == 0)
+        {
+            return false;
+        }
+        activeNum_--;
+        std::lock_guard<std::mutex> lock(taskQueueMtx_);
+        threads_.erase(threadID);
+        curThreadNum_--;
+        idleThreadsNum_--;
+        freeSlots_.push_back(slot);
+        destroyedNum_++;
+        TP_LOG_DEBUG("thread %d retired, now %d", threadID, curThreadNum_.load());
+        exitCond_.notify_all();
+        return true;
+    }
+
+    void controlLoop()
+    {
+        uint64_t lastDone = completedTasks();
+        auto last = std::chrono::steady_clock::now();
+        int hot = 0, cold = 0;
+        std::unique_lock<std::mutex> lock(ctrlMtx_);
+        for (;;)
+        {
+            ctrlCond_.wait_for(lock, std::chrono::milliseconds(CONTROL_INTERVAL_MS), [&]() { return !started_; });
+            if (!started_)
+            {
+                return;
+            }
+            auto now = std::chrono::steady_clock::now();
+            uint64_t done = completedTasks();
+            double rate = (done - lastDone) / std::chrono::duration<double>(now - last).count();
+            last = now;
+            lastDone = done;
+            adjustThreads(rate, hot, cold);
+        }
+    }
+
+    // 按这一轮的完成速率(个/s)定扩还是缩；hot/cold是连着超标/连着闲的轮数，做迟滞用
+    void adjustThreads(double rate, int &hot, int &cold)
+    {
+        unsigned queued = taskNum_;
+        int active = activeNum_;
+        int busy = std::max(0, curThreadNum_ - (int)idleThreadsNum_);
+
+        // Little定律：排队时间 ≈ 排队任务数 / 完成速率；一个都没完成说明线程都卡住了，当成超标
+        double sojournUs = queued == 0 ? 0 : rate > 0 ? queued / rate * 1e6 : 1e18;
+        bool overloaded = sojournUs > sojournTarget_ && busy * 10 >= active * 9;
+        bool underloaded = sojournUs * 2 < sojournTarget_ && busy * 2 < active;
+        hot = overloaded ? hot + 1 : 0;
+        cold = underloaded ? cold + 1 : 0;
+
+        if (hot >= GROW_ROUNDS && active < threadCeiling_)
+        {
+            // 一轮最多翻一倍；先叫醒备用的，不够再现场创建，创建也是在控制线程里
+            int want = std::min(std::max(1, active), threadCeiling_ - active);
+            int got = releaseReserve(want, ROLE_ACTIVE);
+            activeNum_ += got;
+            {
+                std::lock_guard<std::mutex> lock(taskQueueMtx_);
+                for (; got < want && spawnThread(false); ++got)
+                {
+                    activeNum_++;
+                }
+            }
+            hot = 0;
+            TP_LOG_DEBUG("sojourn %.0fus, grow %d threads, now %d active", sojournUs, got, activeNum_.load());
+        }
+        else if (cold >= SHRINK_ROUNDS && active > threadsNum_)
+        {
+            // 一轮退掉多出来的一半，降成备用的接着睡；至少留下初始化线程个数个
+            int got = demote((active - threadsNum_ + 1) / 2);
+            activeNum_ -= got;
+            cold = 0;
+            TP_LOG_DEBUG("idle, shrink %d threads, now %d active", got, activeNum_.load());
+        }
+
+        // 备用线程补到RESERVE_THREADS个，多的让它退出，一轮最多动一个
+        size_t reserve;
+        {
+            std::lock_guard<std::mutex> lock(parkMtx_);
+            reserve = reserveSlots_.size();
+        }
+        if (reserve < (size_t)RESERVE_THREADS)
+        {
+            std::lock_guard<std::mutex> lock(taskQueueMtx_);
+            spawnThread(true);
+        }
+        else if (reserve > (size_t)RESERVE_THREADS)
+        {
+            releaseReserve(1, ROLE_EXIT);
+        }
+    }
+
+    uint64_t completedTasks() const
+    {
+        uint64_t n = 0;
+        int slots = slotsHigh_.load(std::memory_order_acquire);
+        for (int i = 0; i < slots; ++i)
+        {
+            n += workers_[i]->completed.get();
+        }
+        return n;
+    }
+
+    // 占一个空槽位起新线程，reserve时直接进备用名单，不接任务
+    // 调用者持有taskQueueMtx_(保护threads_和freeSlots_)；只有控制线程和start会调
+    bool spawnThread(bool reserve)
+    {
+        if (freeSlots_.empty() || curThreadNum_ >= threadCeiling_)
+        {
+            return false;
+        }
+        int slot = freeSlots_.back();
+        freeSlots_.pop_back();
+        if (!workers_[slot])
+        {
+            // 第一次占用：建Worker、定位置，建好了再让偷任务、统计的人看到
+            // 退下来的槽位压在freeSlots_顶上先用，没用过的从小号往上取，所以建过的总是[0, slotsHigh_)
+            workers_[slot].reset(new Worker(stealing(), spinCount_));
+            placeSlot(slot);
+            slotsHigh_.store(slot + 1, std::memory_order_release);
+        }
+        Worker &w = *workers_[slot];
+        {
+            std::lock_guard<std::mutex> lock(parkMtx_);
+            w.role = reserve ? ROLE_RESERVE : ROLE_ACTIVE;
+            w.parkWord.store(reserve ? 1 : 0, std::memory_order_relaxed);
+            if (reserve)
+            {
+                reserveSlots_.push_back(slot);
+            }
+        }
+        std::unique_ptr<Thread> nt(new Thread(std::bind(&BasicThreadPool::threadFunc, this, std::placeholders::_1, slot)));
+        int tid = nt->getId();
+        threads_.emplace(tid, std::move(nt));
+        threads_[tid]->start();
+
+        curThreadNum_++;
+        idleThreadsNum_++;
+        createdNum_++;
+        TP_LOG_DEBUG("create %s thread, now %d", reserve ? "reserve" : "active", curThreadNum_.load());
+        return true;
+    }
+
+    // 从备用线程里叫起至多n个：ROLE_ACTIVE上岗，ROLE_EXIT退出；返回叫起了几个
+    int releaseReserve(size_t n, int role)
+    {
+        std::vector<Worker *> woken;
+        {
+            std::lock_guard<std::mutex> lock(parkMtx_);
+            while (woken.size() < n && !reserveSlots_.empty())
+            {
+                Worker *w = workers_[reserveSlots_.back()].get();
+                reserveSlots_.pop_back();
+                w->role = role;
+                w->parkWord.store(0, std::memory_order_release);
+                woken.push_back(w);
+            }
+        }
+        for (Worker *w : woken)
+        {
+            futexWakeOne(w->parkWord);
+        }
+        return woken.size();
+    }
+
+    // 从停着的线程里挑至多n个降成备用的，挑停得最久的；它们本来就睡着，只是换个名单，不用叫醒
+    int demote(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(parkMtx_);
+        size_t done = 0;
+        for (size_t i = 0; i < parkedSlots_.size() && done < n;)
+        {
+            int slot = parkedSlots_[i];
+            if (slot == timerWaiter_)
+            {
+                ++i; // 掐着定时器的不动
+                continue;
+            }
+            parkedSlots_.erase(parkedSlots_.begin() + i);
+            sleepersNum_--;
+            nodes_[workers_[slot]->node]->parked--;
+            workers_[slot]->role = ROLE_RESERVE;
+            reserveSlots_.push_back(slot);
+            done++;
+        }
+        return done;
+    }
+
+    // 备用线程在parkWord上睡，不在parkedSlots_里，生产者叫不到；等控制线程叫它上岗或者退出
+    bool waitReserve(int threadID, int slot)
+    {
+        Worker &w = *workers_[slot];
+        while (w.role == ROLE_RESERVE && started_)
+        {
+            futexWait(w.parkWord, 1);
+        }
+        if (w.role == ROLE_ACTIVE)
+        {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(taskQueueMtx_);
+        threads_.erase(threadID);
+        curThreadNum_--;
+        idleThreadsNum_--;
+        if (started_)
+        {
+            freeSlots_.push_back(slot);
+            destroyedNum_++;
+        }
+        TP_LOG_DEBUG("reserve thread %d exit", threadID);
+        exitCond_.notify_all();
+        return false;
+    }
+
+    // threadfunc defines here   为了线程函数能够使用线程池中的同步机制
+    // 不持锁找任务：全局队列(stealing模式还有本地队列、偷别人的)，找不到先转几圈，还没有才停车
+    void threadFunc(int threadID, int slot)
+    {
+        curPool_ = this;
+        curSlot_ = slot;
+        pinThread(workers_[slot]->cpus);
+        Worker &w = *workers_[slot];
+
+        // 线程不是处理一个任务就万事大吉了，轮询拿任务
+        for (;;)
+        {
+            if (w.role != ROLE_ACTIVE)
+            {
+                if (!waitReserve(threadID, slot))
+                {
+                    return;
+                }
+                continue;
+            }
+            if (retireNum_.load(std::memory_order_relaxed) > 0 && retire(threadID, slot))
+            {
+                return;
+            }
+            fireTimers();
+            Task task;
+            if (!findTask(slot, task) && !spinTask(slot, task))
+            {
+                if (!park(threadID, slot))
+                {
+                    return; // 结束线程
+                }
+                continue; // 有任务了，回去找
+            }
+
+            // findTask取到任务时已经标记成忙了
+            TP_LOG_TRACE("thread %d 获取任务成功...", threadID); // 锁外打，打了也只是写进本线程的缓冲
+            runTask(slot, task);
+            idleThreadsNum_++;
+            notifyDrain();
+        }
+    }
+
+    // 池子可能刚空下来：有人在drain里等就叫一下；调用者先改完taskNum_/idleThreadsNum_再调
+    void notifyDrain()
+    {
+        if (drainWaiters_ > 0)
+        {
+            std::lock_guard<std::mutex> lock(taskQueueMtx_);
+            drainCond_.notify_all();
+        }
+    }
+
+    // 跑一个任务，记一下完成数(控制线程算完成速率用，fixed模式又不开统计时不记)
+    // 顺手记下排队和执行各用了多久，记在自己槽位上不和别的线程抢缓存行
+    void runTask(int slot, Task &task)
+    {
+        if constexpr (StatsPolicy::enabled)
+        {
+            uint64_t start = statsNow();
+            task(); //functors
+            uint64_t end = statsNow();
+            WorkerStatsCell &c = workers_[slot]->stats;
+            c.busyNs.add(end - start);
+            c.queueWait.record(start > task.stamp() ? start - task.stamp() : 0);
+            c.execTime.record(end - start);
+        }
+        else
+        {
+            task(); //functors
+        }
+        if constexpr (COUNT_COMPLETED)
+        {
+            workers_[slot]->completed.add();
+        }
+    }
+
+    bool findTask(int slot, Task &task)
+    {
+        // 0. 高优先级lane排在本地队列前面，不然本地队列一直有子任务时心跳就饿死了
+        //    饥饿轮次时所有lane都排在前面，从低往高取
+        bool reverse = starveRound(slot);
+        int node = workers_[slot]->node;
+        if (popInject(task, reverse, stealing() && !reverse ? 1 : LANE_NUM, node))
+        {
+            return true;
+        }
+        if (!stealing())
+        {
+            return false;
+        }
+
+        // 1. 本地队列，LIFO，刚提交的子任务数据还热着
+        LocalNode *local = workers_[slot]->deque->pop();
+
+        // 2. 外部线程提交的任务在全局队列里
+        if (local == nullptr && popInject(task, false, LANE_NUM, node))
+        {
+            return true;
+        }
+
+        // 3. 从别的线程的本地队列顶部偷，从自己的下一个开始轮一圈；没被占用过的槽位本地队列是空的，不用看
+        int n = slotsHigh_.load(std::memory_order_acquire);
+        for (int i = 1; local == nullptr && i < n; ++i)
+        {
+            local = workers_[(slot + i) % n]->deque->steal();
+            if constexpr (StatsPolicy::enabled)
+            {
+                if (local != nullptr)
+                {
+                    workers_[slot]->stats.steals.add();
+                }
+            }
+        }
+
+        if (local == nullptr)
+        {
+            return false;
+        }
+        task = std::move(local->task);
+        NodePool<LocalNode>::put(local);
+        idleThreadsNum_--;
+        --taskNum_;
+        return true;
+    }
+
+    // 停车前先转几圈：突发的RPC流量下一个任务往往马上就到，等到了就不用进内核睡再被叫醒
+    // 转到了任务下次多转一倍(最多spinCount_圈)，转空了下次减半，闲下来很快就直接停车
+    bool spinTask(int slot, Task &task)
+    {
+        if constexpr (!WaitPolicy::spin)
+        {
+            return false;
+        }
+        Worker &w = *workers_[slot];
+        for (uint32_t i = 0; i < w.spinLimit; ++i)
+        {
+            cpuRelax();
+            if (findTask(slot, task))
+            {
+                w.spinLimit = std::min(spinCount_, w.spinLimit * 2);
+                return true;
+            }
+        }
+        w.spinLimit = std::max(w.spinLimit / 2, std::min(spinCount_, 1u));
+        return false;
+    }
+
+    // 任务都取完了，在自己的parkWord上睡，返回false表示线程该退出了
+    // 有定时任务到期也返回true，调用者回去fireTimers；睡着时被降成备用的也返回true，回去waitReserve
+    bool park(int threadID, int slot)
+    {
+        Worker &w = *workers_[slot];
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        {
+            std::lock_guard<std::mutex> lock(parkMtx_);
+            w.parkWord.store(1, std::memory_order_relaxed);
+            parkedSlots_.push_back(slot);
+            sleepersNum_++;
+            nodes_[w.node]->parked++;
+
+            // 只让一个停着的线程掐着时间轮的下一个事件醒，其他的一直睡，不然每个tick都是一群线程一起醒
+            uint64_t tick = timerDeadline_;
+            if (timersNum_ > 0 && tick != UINT64_MAX && (timerWaiter_ == -1 || timerWaiter_ == slot))
+            {
+                timerWaiter_ = slot;
+                deadline = epoch_ + std::chrono::milliseconds(tick);
+            }
+        }
+
+        // 先登记再检查taskNum_，和notifySleepers里的先加taskNum_再看sleepersNum_配对，不会丢唤醒
+        if (taskNum_ == 0 && started_ && !timerDue())
+        {
+            if (deadline == std::chrono::steady_clock::time_point::max())
+            {
+                futexWait(w.parkWord, 1);
+            }
+            else
+            {
+                auto left = deadline - std::chrono::steady_clock::now();
+                if (left > left.zero())
+                {
+                    futexWaitFor(w.parkWord, 1, left);
+                }
+            }
+        }
+
+        bool handoff = false;
+        {
+            std::lock_guard<std::mutex> lock(parkMtx_);
+            // 不是被叫醒的(超时、还没睡就发现有活了、假唤醒)，自己从名单上下来
+            auto it = std::find(parkedSlots_.begin(), parkedSlots_.end(), slot);
+            if (it != parkedSlots_.end())
+            {
+                parkedSlots_.erase(it);
+                sleepersNum_--;
+                nodes_[w.node]->parked--;
+            }
+            // 被控制线程降成备用的，parkWord留着1，回去在waitReserve里接着睡
+            if (w.role == ROLE_ACTIVE)
+            {
+                w.parkWord.store(0, std::memory_order_relaxed);
+            }
+            if (timerWaiter_ == slot)
+            {
+                // 掐表的线程要去干活了，叫醒一个停着的来接班；定时任务到期就马上回来，不用
+                timerWaiter_ = -1;
+                handoff = timersNum_ > 0 && !timerDue();
+            }
+        }
+        if (handoff)
+        {
+            notifySleepers();
+        }
+
+        if (!started_ && taskNum_ == 0)
+        {
+            // 线程池退出，任务执行完后的线程也要回收
+            std::lock_guard<std::mutex> lock(taskQueueMtx_);
+            threads_.erase(threadID);
+            curThreadNum_--;
+            TP_LOG_DEBUG("thread %d exit", threadID);
+            exitCond_.notify_all();
+            return false;
+        }
+        return true;
+    }
+
+    // 放了n个任务，从停着的线程里叫醒至多n个，一个任务只叫醒一个线程
+    // 后停的先叫，它的缓存还热，停得久的接着睡；没人停着就只读一个原子变量
+    // 任务放在node节点上就先叫这个节点的，-1不挑
+    void notifySleepers(size_t n = 1, int node = -1)
+    {
+        while (n > 0 && sleepersNum_ > 0)
+        {
+            const size_t WAKE_BATCH = 16;
+            Worker *woken[WAKE_BATCH];
+            size_t k = 0;
+            {
+                std::lock_guard<std::mutex> lock(parkMtx_);
+                for (; k < n && k < WAKE_BATCH && !parkedSlots_.empty(); ++k)
+                {
+                    size_t pick = parkedSlots_.size() - 1;
+                    for (size_t j = pick + 1; node >= 0 && nodes_.size() > 1 && j-- > 0;)
+                    {
+                        if (workers_[parkedSlots_[j]]->node == node)
+                        {
+                            pick = j;
+                            break;
+                        }
+                    }
+                    woken[k] = workers_[parkedSlots_[pick]].get();
+                    parkedSlots_.erase(parkedSlots_.begin() + pick);
+                    sleepersNum_--;
+                    nodes_[woken[k]->node]->parked--;
+                    woken[k]->parkWord.store(0, std::memory_order_release);
+                }
+            }
+            // 锁外进内核，Worker和线程池一样长寿，不怕被叫的线程先走了
+            for (size_t i = 0; i < k; ++i)
+            {
+                futexWakeOne(woken[i]->parkWord);
+            }
+            if (k == 0)
+            {
+                return;
+            }
+            n -= k;
+        }
+    }
+
+    bool PoolStatus() const // true -- running
+    {
+        return started_;
+    }
+
+    // 策略定死的返回常量，编译器把另一边的分支整个删掉；Runtime的才读成员
+    bool stealing() const
+    {
+        if constexpr (QueuePolicy::runtime)
+        {
+            return schedule_ == tpSchedule::STEALING_;
+        }
+        return QueuePolicy::schedule == tpSchedule::STEALING_;
+    }
+    bool lockfree() const
+    {
+        if constexpr (QueuePolicy::runtime)
+        {
+            return queue_ == tpQueue::LOCKFREE_;
+        }
+        return QueuePolicy::queue == tpQueue::LOCKFREE_;
+    }
+    bool cached() const
+    {
+        if constexpr (GrowthPolicy::runtime)
+        {
+            return pattern_ == tpPattern::CACHED_;
+        }
+        return GrowthPolicy::pattern == tpPattern::CACHED_;
+    }
+
+    // 完成数只有控制线程和统计用得上
+    static constexpr bool COUNT_COMPLETED = StatsPolicy::enabled || GrowthPolicy::runtime || GrowthPolicy::pattern == tpPattern::CACHED_;
+
+    struct NoWorkerStats
+    {
+    };
+
+private:
+    // 线程池工作模式
+    tpPattern pattern_;
+    // 线程列表
+    std::unordered_map<int, std::unique_ptr<Thread>> threads_;
+    // 初始化线程池数量
+    uint16_t threadsNum_;
+    // 线程数阈值 cached
+    uint16_t threadCeiling_;
+    std::atomic_int retireNum_{0};       // resize缩容还差几个线程退，忙着的干完手上的来领
+    // 线程池真实线程数量
+    std::atomic_int curThreadNum_;
+    // 空闲线程数量(cached模式下，如果空闲线程的数量达到一定阈值，那么要销毁一些)
+    std::atomic_uint idleThreadsNum_;
+
+    // 全局队列按NUMA节点分组，每组里每个优先级一条lane，下标就是tpPriority；NONE_时只有一组
+    struct alignas(64) NodeQueues
+    {
+        NodeQueues()
+        {
+            for (int i = 0; i < LANE_NUM; ++i)
+            {
+                laneNum[i] = 0;
+            }
+        }
+        std::mutex mtx;                                   // LOCKED_模式保护lanes，不和别的锁嵌套
+        std::queue<Task> lanes[LANE_NUM];                 // 生命周期不由用户了，也不用写shared_ptr了
+        std::unique_ptr<MPMCQueue<Task>> rings[LANE_NUM]; // LOCKFREE_模式下代替lanes
+        std::atomic_uint laneNum[LANE_NUM];               // 每条lane里的任务数
+        std::atomic<uint32_t> laneCeiling[LANE_NUM];      // 这个节点每条lane最多放几个，运行中能调
+        std::atomic_int parked{0};                        // 停在这个节点上的线程数，parkMtx_里改
+    };
+    std::vector<std::unique_ptr<NodeQueues>> nodes_; // start之后大小不变
+    tpQueue queue_;
+    std::atomic_int fullWaitersNum_;                      // 在queueFull_上等队列腾位置的生产者数
+    tpOverload overload_;                                 // submitTask队列满时的策略
+    std::chrono::nanoseconds submitTimeout_;              // BLOCK_最多等多久
+    std::atomic_uint taskNum_;                            // 所有队列里的任务总数
+    uint32_t laneCeiling_[LANE_NUM];                      // 每条lane的任务数阈值，平分到各个节点
+
+    // 绑核和NUMA
+    tpPlacement placement_;
+    std::vector<std::vector<int>> cpuSets_; // PINNED_用
+    NumaTopology topology_;                 // 空的话start时从sysfs读
+    std::vector<int> cpuNode_;              // cpu号 -> 节点号，外部线程提交时看自己在哪个节点
+
+    // 线程在岗的状态，cached模式下控制线程改，parkMtx_里改
+    enum WorkerRole
+    {
+        ROLE_ACTIVE,  // 接任务
+        ROLE_RESERVE, // 备用，睡着不接任务
+        ROLE_EXIT,    // 备用的多了，让它退出
+    };
+
+    // 本地队列里存的是指针，任务包在节点里，节点在NodePool里循环用
+    struct LocalNode
+    {
+        Task task;
+        LocalNode *next_ = nullptr; // 在NodePool空闲链表里时用
+    };
+
+    // 每个线程槽位私有的数据
+    struct Worker
+    {
+        Worker(bool stealing, uint32_t spin)
+            : parkWord(0), spinLimit(spin)
+        {
+            if (stealing)
+            {
+                deque.reset(new WorkStealingDeque<LocalNode>());
+            }
+        }
+        std::unique_ptr<WorkStealingDeque<LocalNode>> deque; // 本地任务队列，stealing模式才有
+        unsigned popCount = 0;                                // 取了几次任务，算饥饿轮次用
+        std::atomic<uint32_t> parkWord;                       // 1停着，叫醒的人改成0再futex唤醒
+        uint32_t spinLimit;                                   // 下次停车前转几圈，自适应
+        int node = 0;                                         // 属于哪个NUMA节点，先取这个节点的全局队列
+        std::vector<int> cpus;                                // 绑在哪些cpu上，空的不绑
+        std::atomic_int role{ROLE_ACTIVE};                    // WorkerRole
+        StatCounter completed;                                // 跑完了几个任务，只有占着这个槽位的线程写
+        typename std::conditional<StatsPolicy::enabled, WorkerStatsCell, NoWorkerStats>::type stats; // 只有占着这个槽位的线程写
+    };
+    std::vector<std::unique_ptr<Worker>> workers_; // start之后大小不变，下标就是槽位号；没占用过的是空的
+    std::vector<int> freeSlots_;                   // 还没被占用的槽位，taskQueueMtx_保护
+    std::atomic_int slotsHigh_{0};                 // 占用过的最大槽位号+1，只在taskQueueMtx_里涨，比它小的Worker都建好了
+
+    tpSchedule schedule_;
+    // 停着的线程，每个睡在自己的parkWord上，生产者按任务数点名叫醒
+    std::mutex parkMtx_;             // 保护parkedSlots_、reserveSlots_和timerWaiter_，里面不再拿别的锁
+    std::vector<int> parkedSlots_;   // 停着的槽位，后停的在后面
+    std::atomic_int sleepersNum_;    // parkedSlots_的大小，不加锁先看一眼
+    uint32_t spinCount_;             // 停车前最多转几圈
+
+    // cached模式的弹性控制：控制线程按排队时间和忙闲定上岗的线程数
+    std::thread controller_;
+    std::mutex ctrlMtx_;
+    std::condition_variable ctrlCond_; // 析构时叫醒控制线程
+    std::atomic_int activeNum_;        // 上岗的线程数，备用的不算
+    std::vector<int> reserveSlots_;    // 备用线程的槽位
+    double sojournTarget_;             // us
+
+    // 当前线程属于哪个线程池的哪个槽位，池外线程为nullptr
+    static inline thread_local BasicThreadPool *curPool_ = nullptr;
+    static inline thread_local int curSlot_ = -1;
+
+    // 不在热路径上的统计，都是慢路径顺手加一下
+    std::atomic<uint64_t> rejectedNum_{0};  // 队列满被拒的提交
+    std::atomic<uint64_t> droppedNum_{0};   // DROP_OLDEST_丢掉的任务
+    std::atomic<uint64_t> callerRunsNum_{0}; // CALLER_RUNS_在提交线程上跑的任务
+    std::atomic<uint64_t> expiredNum_{0};    // 取到时过了deadline没跑的任务
+    std::atomic<uint64_t> cancelledNum_{0};  // 取到时已经取消没跑的任务
+    std::atomic<uint64_t> createdNum_{0};   // cached模式控制线程创建的线程(含备用的)
+    std::atomic<uint64_t> destroyedNum_{0}; // cached模式退掉的备用线程
+
+    // 定时任务
+    std::mutex timerMtx_;                               // 保护wheel_，不和taskQueueMtx_嵌套
+    TimerWheel<std::shared_ptr<TimerJob>> wheel_;       // 1 tick = 1ms
+    std::atomic<uint64_t> timerDeadline_;               // 时间轮下一个事件的tick，没有就是UINT64_MAX
+    std::atomic_uint timersNum_;                        // 时间轮里的定时任务数(含已取消还没到期的)
+    int timerWaiter_;                                   // 掐着timerDeadline_睡的槽位，-1没有，parkMtx_保护
+    std::chrono::steady_clock::time_point epoch_;       // tick 0
+
+    StrandTable strands_; // submitOrdered按key排队的任务
+
+    // 线程池启动状态，如果已经启动，则不允许再进行set
+    std::atomic_bool started_;
 
     // 线程同步
     std::mutex taskQueueMtx_;
     std::condition_variable queueFull_;
-    std::condition_variable queueEmpty_;
 
     std::condition_variable exitCond_; // 回收用
+    std::condition_variable drainCond_; // drain在上面等池子空下来，taskQueueMtx_
+    std::atomic_int drainWaiters_{0};   // 在drain里等着的线程数，没人等就不去拿锁叫
 
     // noncopyable
-    ThreadPool(const ThreadPool &) = delete;
-    void operator=(const ThreadPool &) = delete;
+    BasicThreadPool(const BasicThreadPool &) = delete;
+    void operator=(const BasicThreadPool &) = delete;
 };
+
+// 默认的线程池：模式都在运行时用setter选
+using ThreadPool = BasicThreadPool<>;
+
+// 最精简的：固定线程数、共享有锁队列、不开统计，提交和取任务的路径上不剩模式判断
+using FixedThreadPool = BasicThreadPool<SharedQueue, SpinThenPark, FixedGrowth, NoStats>;
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "task.h"
+
+// 分层时间轮，4层每层64格，一格是下一层转一圈，tick由使用者定(线程池里是1ms)，能表示64^4个tick
+// 定时器放在能装下它剩余时间的最低一层，上层的格子轮到时整格往下层倒(cascade)
+// 不加锁，由使用者保护
+template <typename T>
+class TimerWheel
+{
+public:
+    TimerWheel()
+        : current_(0), size_(0)
+    {
+        for (int l = 0; l < LEVELS; ++l)
+        {
+            bitmap_[l] = 0;
+            for (int i = 0; i < SLOTS; ++i)
+            {
+                slots_[l][i] = nullptr;
+            }
+        }
+    }
+    ~TimerWheel()
+    {
+        for (int l = 0; l < LEVELS; ++l)
+        {
+            for (int i = 0; i < SLOTS; ++i)
+            {
+                Node *n = slots_[l][i];
+                while (n != nullptr)
+                {
+                    Node *next = n->next;
+                    delete n;
+                    n = next;
+                }
+            }
+        }
+    }
+
+    // 已经过期的放到下一个tick
+    void add(uint64_t expire, T item)
+    {
+        if (expire <= current_)
+        {
+            expire = current_ + 1;
+        }
+        insert(new Node{expire, std::move(item), nullptr});
+        size_++;
+    }
+
+    // 走到now，到期的逐个交给onExpire(expire, T&&)，回调里可以再add
+    template <typename F>
+    void advance(uint64_t now, F &&onExpire)
+    {
+        for (;;)
+        {
+            uint64_t ev = nextEvent();
+            if (ev > now)
+            {
+                current_ = now > current_ ? now : current_;
+                return;
+            }
+            current_ = ev;
+
+            // 上层先往下倒，倒下来的可能正好落在这一格
+            for (int l = LEVELS - 1; l >= 1; --l)
+            {
+                if ((current_ & ((uint64_t(1) << (BITS * l)) - 1)) == 0)
+                {
+                    int idx = (current_ >> (BITS * l)) & MASK;
+                    Node *n = takeSlot(l, idx);
+                    while (n != nullptr)
+                    {
+                        Node *next = n->next;
+                        insert(n);
+                        n = next;
+                    }
+                }
+            }
+
+            Node *n = takeSlot(0, current_ & MASK);
+            while (n != nullptr)
+            {
+                Node *next = n->next;
+                size_--;
+                onExpire(n->expire, std::move(n->item));
+                delete n;
+                n = next;
+            }
+        }
+    }
+
+    // 下一次有事发生(到期或者往下倒)的tick，只会比真正的到期早，空的时候返回UINT64_MAX
+    uint64_t nextEvent() const
+    {
+        uint64_t best = UINT64_MAX;
+        for (int l = 0; l < LEVELS; ++l)
+        {
+            if (bitmap_[l] == 0)
+            {
+                continue;
+            }
+            uint64_t base = current_ >> (BITS * l);
+            int pos = base & MASK;
+            // 从当前格的下一格开始转一圈，第一个非空的格子
+            uint64_t rotated = rotr(bitmap_[l], (pos + 1) & MASK);
+            uint64_t k = __builtin_ctzll(rotated) + 1;
+            uint64_t tick = (base + k) << (BITS * l);
+            if (tick < best)
+            {
+                best = tick;
+            }
+        }
+        return best;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    static const int LEVELS = 4;
+    static const int BITS = 6;
+    static const int SLOTS = 1 << BITS;
+    static const int MASK = SLOTS - 1;
+
+    struct Node
+    {
+        uint64_t expire;
+        T item;
+        Node *next;
+    };
+
+    static uint64_t rotr(uint64_t x, int r)
+    {
+        return r == 0 ? x : (x >> r) | (x << (64 - r));
+    }
+
+    // 往下倒时expire可能正好等于current_，落在第0层当前格，紧接着就处理
+    void insert(Node *n)
+    {
+        uint64_t delta = n->expire - current_;
+        int l = 0;
+        while (l < LEVELS - 1 && delta >= (uint64_t(1) << (BITS * (l + 1))))
+        {
+            ++l;
+        }
+        int idx;
+        if (delta >= (uint64_t(1) << (BITS * LEVELS)))
+        {
+            // 超出整个轮子，先挂在最上层最晚轮到的格子，倒下来时再重新算
+            idx = ((current_ >> (BITS * l)) + MASK) & MASK;
+        }
+        else
+        {
+            idx = (n->expire >> (BITS * l)) & MASK;
+        }
+        n->next = slots_[l][idx];
+        slots_[l][idx] = n;
+        bitmap_[l] |= uint64_t(1) << idx;
+    }
+
+    Node *takeSlot(int l, int idx)
+    {
+        Node *n = slots_[l][idx];
+        slots_[l][idx] = nullptr;
+        bitmap_[l] &= ~(uint64_t(1) << idx);
+        return n;
+    }
+
+private:
+    uint64_t current_; // 已经处理到的tick
+    size_t size_;
+    Node *slots_[LEVELS][SLOTS];
+    uint64_t bitmap_[LEVELS]; // 每层哪些格子非空，找下一个事件不用一格格扫
+
+    // noncopyable
+    TimerWheel(const TimerWheel &) = delete;
+    void operator=(const TimerWheel &) = delete;
+};
+
+//---------------------------------------------
+
+// 一个定时任务，时间轮里和TimerHandle里共享
+struct TimerJob
+{
+    explicit TimerJob(InlineTask f, uint64_t p)
+        : fn(std::move(f)), period(p), cancelled(false), running(false)
+    {
+    }
+
+    // 周期任务上一次还没跑完就跳过这一次，同一个fn不会被两个线程同时调
+    void run()
+    {
+        if (cancelled || running.exchange(true))
+        {
+            return;
+        }
+        fn();
+        running = false;
+    }
+
+    InlineTask fn;
+    uint64_t period; // tick，0表示只跑一次
+    std::atomic_bool cancelled;
+    std::atomic_bool running;
+};
+
+// submitAfter/submitAt/submitEvery返回的句柄，取消后还没跑的不会再跑
+class TimerHandle
+{
+public:
+    TimerHandle() = default;
+    explicit TimerHandle(std::shared_ptr<TimerJob> job)
+        : job_(std::move(job))
+    {
+    }
+
+    // 已经在跑的那一次拦不住
+    void cancel()
+    {
+        if (job_)
+        {
+            job_->cancelled = true;
+        }
+    }
+
+    bool cancelled() const
+    {
+        return job_ && job_->cancelled;
+    }
+
+    bool valid() const
+    {
+        return job_ != nullptr;
+    }
+
+private:
+    std::shared_ptr<TimerJob> job_;
+};
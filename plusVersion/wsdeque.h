@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Chase-Lev 工作窃取双端队列
+// 只有拥有者线程可以 push/pop 底部(LIFO，缓存友好)，其他线程从顶部 steal(FIFO)
+// 队列里存的是 T* ，对象的生命周期由使用者管理
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(int64_t capacity = 64)
+        : top_(0), bottom_(0)
+    {
+        std::unique_ptr<Array> a(new Array(capacity));
+        array_.store(a.get(), std::memory_order_relaxed);
+        garbage_.emplace_back(std::move(a));
+    }
+    ~WorkStealingDeque() = default;
+
+    // 仅拥有者调用
+    void push(T *item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array *a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity() - 1)
+        {
+            a = grow(a, b, t);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 仅拥有者调用，空时返回nullptr
+    T *pop()
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array *a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        T *item = nullptr;
+        if (t <= b)
+        {
+            item = a->get(b);
+            if (t == b)
+            {
+                // 只剩最后一个，和窃取者抢
+                if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    item = nullptr;
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程调用，空或者抢失败都返回nullptr
+    T *steal()
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t < b)
+        {
+            Array *a = array_.load(std::memory_order_acquire);
+            T *item = a->get(t);
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+            return item;
+        }
+        return nullptr;
+    }
+
+    bool empty() const
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+private:
+    // 环形数组，容量为2的幂
+    class Array
+    {
+    public:
+        explicit Array(int64_t capacity)
+            : capacity_(capacity), mask_(capacity - 1), items_(new std::atomic<T *>[capacity])
+        {
+        }
+
+        int64_t capacity() const { return capacity_; }
+
+        void put(int64_t i, T *item)
+        {
+            items_[i & mask_].store(item, std::memory_order_relaxed);
+        }
+        T *get(int64_t i) const
+        {
+            return items_[i & mask_].load(std::memory_order_relaxed);
+        }
+
+    private:
+        int64_t capacity_;
+        int64_t mask_;
+        std::unique_ptr<std::atomic<T *>[]> items_;
+    };
+
+    Array *grow(Array *old, int64_t b, int64_t t)
+    {
+        std::unique_ptr<Array> a(new Array(old->capacity() * 2));
+        for (int64_t i = t; i < b; ++i)
+        {
+            a->put(i, old->get(i));
+        }
+        Array *raw = a.get();
+        // 旧数组可能还在被窃取者读，不能马上释放，等队列析构时统一回收
+        garbage_.emplace_back(std::move(a));
+        array_.store(raw, std::memory_order_release);
+        return raw;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    alignas(64) std::atomic<Array *> array_;
+    std::vector<std::unique_ptr<Array>> garbage_; // 只有拥有者扩容时访问
+};